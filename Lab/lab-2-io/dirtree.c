@@ -15,13 +15,22 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <assert.h>
 #include <grp.h>
 #include <pwd.h>
+#include <pthread.h>
 
 #define MAX_DIR 64            ///< maximum number of directories supported
+#define MAX_THREADS 64        ///< maximum number of walker threads (-j)
+#define DIRBUF_SIZE 32768     ///< initial size of the directory entry arena (getdents64 batch)
+#define STATX_MASK  (STATX_SIZE | STATX_BLOCKS | STATX_UID | STATX_GID) ///< metadata used by -v
+#define OUTBUF_SIZE 65536     ///< size of the standard output buffer
+#define SEGBUF_SIZE 1024      ///< initial size of a directory's output buffer in parallel mode
+#define NAME_WIDTH  54        ///< width of the name column in verbose mode
+#define IDCACHE_SIZE 64       ///< initial number of slots of the user/group name caches
 
 /// @brief output control flags
 #define F_TREE      0x1       ///< enable tree view
@@ -40,6 +49,108 @@ struct summary {
   unsigned long long blocks;  ///< total number of blocks (512 byte blocks)
 };
 
+/// @brief output buffer. Text is formatted directly into the buffer. Buffers with a file descriptor
+///        are flushed with write() when full, memory buffers (fd < 0) grow instead.
+struct outbuf {
+  char *buf;                  ///< buffer
+  size_t len;                 ///< number of bytes in buf
+  size_t cap;                 ///< capacity of buf
+  int fd;                     ///< file descriptor to flush to or -1
+};
+
+/// @brief prefix string printed in front of the entries of the current directory. Each level
+///        appends its indentation before descending and removes it afterwards, so all levels share
+///        one buffer.
+struct prefix {
+  char *s;                    ///< prefix string
+  size_t len;                 ///< length of s
+  size_t cap;                 ///< capacity of s
+};
+
+/// @brief user or group id to name mapping
+struct idname {
+  unsigned int id;            ///< user or group id
+  char *name;                 ///< name (NULL: slot is empty)
+};
+
+/// @brief cache of user or group names, an open-addressing hash table with linear probing. Names
+///        are never evicted, so returned names stay valid until the cache is released.
+struct idcache {
+  struct idname *slot;        ///< slots
+  size_t size;                ///< number of slots (power of two)
+  size_t used;                ///< number of occupied slots
+  int group;                  ///< 1: group names, 0: user names
+};
+
+/// @brief entries of one directory, read with getdents64 into a single arena
+struct dirbuf {
+  char *arena;                ///< raw directory records
+  size_t len;                 ///< number of bytes used in arena
+  struct dirent64 **ent;      ///< pointers to the entries in arena (without '.' and '..')
+  int n;                      ///< number of entries
+};
+
+/// @brief one segment of a directory's output in parallel mode: text that is followed by the
+///        complete output of a subdirectory (none for the last segment)
+struct segment {
+  char *text;                 ///< formatted output
+  size_t len;                 ///< length of text
+  struct dirnode *child;      ///< subdirectory printed after text or NULL
+};
+
+/// @brief open directory whose queued subdirectories are opened relative to it in parallel mode.
+///        The descriptor is closed once the directory has been read and all queued subdirectories
+///        have been processed.
+struct dirref {
+  int fd;                     ///< directory file descriptor
+  int refs;                   ///< number of references
+};
+
+/// @brief a directory processed by the walker threads. Its output is kept in segments until the
+///        main thread merges it back in the order of the sequential walk.
+struct dirnode {
+  struct dirref *parent;      ///< directory dn is relative to (NULL: current directory)
+  char *dn;                   ///< name of the directory relative to parent
+  char *pstr;                 ///< prefix string
+  struct summary stats;       ///< statistics of the directory's entries (excluding subdirectories)
+  struct outbuf out;          ///< current output segment (memory buffer)
+  struct segment *seg;        ///< completed segments
+  int nseg;                   ///< number of completed segments
+  int done;                   ///< set once the directory has been processed
+};
+
+/// @brief work-stealing deque of a walker thread. The owner pushes and pops directories at the
+///        bottom (depth-first), idle threads steal from the top where the largest subtrees are.
+struct deque {
+  pthread_mutex_t lock;       ///< protects the deque
+  struct dirnode **task;      ///< ring buffer of size entries
+  unsigned long top;          ///< index of oldest task
+  unsigned long bottom;       ///< index after newest task
+  unsigned long size;         ///< capacity (power of two)
+};
+
+/// @brief pool of walker threads (-j)
+static struct {
+  int nthreads;               ///< number of walker threads (0: sequential walk)
+  unsigned int flags;         ///< output control flags (F_*)
+  pthread_t thread[MAX_THREADS];  ///< walker threads
+  struct deque dq[MAX_THREADS];   ///< per-thread deques
+  int pending;                ///< number of queued directories
+  int idle;                   ///< number of sleeping walkers
+  int shutdown;               ///< set to terminate the walkers
+  pthread_mutex_t lock;       ///< protects sleeping/waking and dirnode.done
+  pthread_cond_t work;        ///< signalled when a directory is queued
+  pthread_cond_t done;        ///< signalled when a directory has been processed
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+           .done = PTHREAD_COND_INITIALIZER };
+
+static __thread int self = 0; ///< index of the calling walker thread
+static struct outbuf output = { .fd = STDOUT_FILENO }; ///< buffered standard output
+static pthread_mutex_t nss_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the name caches
+                                                             ///< (getpwuid/getgrgid not MT-safe)
+static struct idcache users = { .group = 0 };  ///< user name cache
+static struct idcache groups = { .group = 1 }; ///< group name cache
+
 
 /// @brief abort the program with EXIT_FAILURE and an optional error message
 ///
@@ -51,24 +162,256 @@ void panic(const char *msg)
 }
 
 
-/// @brief read next directory entry from open directory 'dir'. Ignores '.' and '..' entries
+/// @brief write @a n bytes at @a s to file descriptor @a fd. Output errors are ignored like stdio
+///        does; errno is preserved.
+static void writeAll(int fd, const char *s, size_t n)
+{
+  int err = errno;
+
+  while (n > 0) {
+    ssize_t res = write(fd, s, n);
+    if ((res < 0) && (errno == EINTR)) continue;
+    if (res <= 0) break;
+    s += res;
+    n -= res;
+  }
+
+  errno = err;
+}
+
+
+/// @brief write the contents of output buffer @a out to its file descriptor
+static void outFlush(struct outbuf *out)
+{
+  writeAll(out->fd, out->buf, out->len);
+  out->len = 0;
+}
+
+
+/// @brief make room for @a n more bytes in output buffer @a out
+static void outReserve(struct outbuf *out, size_t n)
+{
+  if (out->cap - out->len >= n) return;
+  if (out->fd >= 0) outFlush(out);
+  if (out->cap - out->len >= n) return;
+
+  size_t cap = out->cap ? 2*out->cap : (out->fd >= 0 ? OUTBUF_SIZE : SEGBUF_SIZE);
+  while (cap - out->len < n) cap *= 2;
+  char *buf = realloc(out->buf, cap);
+  if (buf == NULL) panic("ERROR: Cannot allocate memory");
+  out->buf = buf;
+  out->cap = cap;
+}
+
+
+/// @brief append @a n bytes at @a s to output buffer @a out. Large blocks bypass the buffer of a
+///        file descriptor.
+static void outWrite(struct outbuf *out, const char *s, size_t n)
+{
+  if ((out->fd >= 0) && (n >= OUTBUF_SIZE)) {
+    outFlush(out);
+    writeAll(out->fd, s, n);
+    return;
+  }
+
+  outReserve(out, n);
+  memcpy(out->buf + out->len, s, n);
+  out->len += n;
+}
+
+
+/// @brief append formatted output to output buffer @a out
+static void outPrintf(struct outbuf *out, const char *fmt, ...)
+{
+  va_list ap, aq;
+
+  va_start(ap, fmt);
+  va_copy(aq, ap);
+  int n = vsnprintf(out->buf + out->len, out->cap - out->len, fmt, ap);
+  if ((n >= 0) && ((size_t)n >= out->cap - out->len)) {
+    outReserve(out, n + 1);
+    n = vsnprintf(out->buf + out->len, out->cap - out->len, fmt, aq);
+  }
+  if (n > 0) out->len += n;
+  va_end(aq);
+  va_end(ap);
+}
+
+
+/// @brief append the name column of an entry to output buffer @a out: prefix @a pfx, connector
+///        @a conn, and @a name. If @a truncate is set, columns longer than NAME_WIDTH characters
+///        are cut and end in "...". The column is padded with spaces to @a width characters.
+static void outName(struct outbuf *out, const struct prefix *pfx, const char *conn,
+                    const char *name, int truncate, size_t width)
+{
+  const char *part[3] = { pfx->s, conn, name };
+  size_t len[3] = { pfx->len, strlen(conn), strlen(name) };
+  size_t total = len[0] + len[1] + len[2];
+  size_t budget = total;
+
+  if (truncate && (total > NAME_WIDTH)) budget = NAME_WIDTH - 3;
+  for (int i = 0; i < 3; i++) {
+    size_t n = len[i] < budget ? len[i] : budget;
+    outWrite(out, part[i], n);
+    budget -= n;
+  }
+  if (truncate && (total > NAME_WIDTH)) {
+    outWrite(out, "...", 3);
+    total = NAME_WIDTH;
+  }
+
+  if (total < width) {
+    outReserve(out, width - total);
+    memset(out->buf + out->len, ' ', width - total);
+    out->len += width - total;
+  }
+}
+
+
+/// @brief append @a s to prefix @a p
+static void pfxPush(struct prefix *p, const char *s)
+{
+  size_t n = strlen(s);
+
+  if (p->len + n + 1 > p->cap) {
+    size_t cap = p->cap ? 2*p->cap : 256;
+    while (p->len + n + 1 > cap) cap *= 2;
+    char *str = realloc(p->s, cap);
+    if (str == NULL) panic("ERROR: Cannot allocate memory");
+    p->s = str;
+    p->cap = cap;
+  }
+
+  memcpy(p->s + p->len, s, n + 1);
+  p->len += n;
+}
+
+
+/// @brief cut prefix @a p back to its first @a len characters
+static void pfxPop(struct prefix *p, size_t len)
+{
+  p->len = len;
+  p->s[len] = '\0';
+}
+
+
+/// @brief home slot of @a id in a table of @a size slots (Fibonacci hashing)
+static size_t idSlot(unsigned int id, size_t size)
+{
+  return (size_t)((id * 2654435769u) >> 8) & (size - 1);
+}
+
+
+/// @brief name of user or group @a id from cache @a c. Names not in the cache are looked up with
+///        getpwuid/getgrgid; ids without a name are shown as numbers. Call with nss_lock held.
 ///
-/// @param dir open DIR* stream
-/// @retval entry on success
-/// @retval NULL on error or if there are no more entries
-struct dirent *getNext(DIR *dir)
+/// @param c user or group name cache
+/// @param id user or group id
+/// @retval name
+static const char *idName(struct idcache *c, unsigned int id)
 {
-  struct dirent *next;
-  int ignore;
+  // keep the load factor below 1/2
+  if (2*(c->used + 1) > c->size) {
+    size_t size = c->size ? 2*c->size : IDCACHE_SIZE;
+    struct idname *slot = calloc(size, sizeof(struct idname));
+    if (slot == NULL) panic("ERROR: Cannot allocate memory");
+    for (size_t i = 0; i < c->size; i++) {
+      if (c->slot[i].name == NULL) continue;
+      size_t h = idSlot(c->slot[i].id, size);
+      while (slot[h].name != NULL) h = (h + 1) & (size - 1);
+      slot[h] = c->slot[i];
+    }
+    free(c->slot);
+    c->slot = slot;
+    c->size = size;
+  }
 
-  do {
-    errno = 0;
-    next = readdir(dir);
-    if (errno != 0) perror(NULL);
-    ignore = next && ((strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0));
-  } while (next && ignore);
+  size_t h = idSlot(id, c->size);
+  while (c->slot[h].name != NULL) {
+    if (c->slot[h].id == id) return c->slot[h].name;
+    h = (h + 1) & (c->size - 1);
+  }
+
+  const char *name = NULL;
+  char number[16];
+  if (c->group) {
+    struct group *gr = getgrgid(id);
+    if (gr != NULL) name = gr->gr_name;
+  } else {
+    struct passwd *pw = getpwuid(id);
+    if (pw != NULL) name = pw->pw_name;
+  }
+  if (name == NULL) {
+    snprintf(number, sizeof(number), "%u", id);
+    name = number;
+  }
 
-  return next;
+  c->slot[h] = (struct idname) { .id = id, .name = strdup(name) };
+  if (c->slot[h].name == NULL) panic("ERROR: Cannot allocate memory");
+  c->used++;
+
+  return c->slot[h].name;
+}
+
+
+/// @brief release name cache @a c
+static void idFree(struct idcache *c)
+{
+  for (size_t i = 0; i < c->size; i++) free(c->slot[i].name);
+  free(c->slot);
+  *c = (struct idcache) { .group = c->group };
+}
+
+
+/// @brief read all entries of open directory @a fd into @a db, ignoring '.' and '..'. The records
+///        are read in large getdents64 batches into one growing arena and @a db->ent points into
+///        it, so a directory costs two allocations regardless of its number of entries.
+///
+/// @param fd file descriptor of an open directory
+/// @param db directory buffer. Release with free(db->ent) and free(db->arena).
+/// @retval 0 on success
+/// @retval -1 if out of memory
+static int readEntries(int fd, struct dirbuf *db)
+{
+  size_t cap = DIRBUF_SIZE;
+
+  *db = (struct dirbuf) { .arena = malloc(cap) };
+  if (db->arena == NULL) return -1;
+
+  for (;;) {
+    // keep the batches large; the arena doubles when less than half a batch is left
+    if (cap - db->len < DIRBUF_SIZE/2) {
+      char *arena = realloc(db->arena, 2*cap);
+      if (arena == NULL) {
+        free(db->arena);
+        return -1;
+      }
+      db->arena = arena;
+      cap *= 2;
+    }
+
+    ssize_t nread = getdents64(fd, db->arena + db->len, cap - db->len);
+    if (nread < 0) perror(NULL);
+    if (nread <= 0) break;
+    db->len += nread;
+  }
+
+  size_t count = 0;
+  for (size_t off = 0; off < db->len; off += ((struct dirent64*)(db->arena + off))->d_reclen) {
+    count++;
+  }
+  db->ent = malloc((count > 0 ? count : 1) * sizeof(struct dirent64*));
+  if (db->ent == NULL) {
+    free(db->arena);
+    return -1;
+  }
+  for (size_t off = 0; off < db->len; off += ((struct dirent64*)(db->arena + off))->d_reclen) {
+    struct dirent64 *e = (struct dirent64*)(db->arena + off);
+    if ((strcmp(e->d_name, ".") != 0) && (strcmp(e->d_name, "..") != 0)) db->ent[db->n++] = e;
+  }
+
+  errno = 0;
+  return 0;
 }
 
 
@@ -81,8 +424,8 @@ struct dirent *getNext(DIR *dir)
 /// @retval 1  if a>b
 static int dirent_compare(const void *a, const void *b)
 {
-  struct dirent *e1 = *((struct dirent**)a);
-  struct dirent *e2 = *((struct dirent**)b);
+  struct dirent64 *e1 = *((struct dirent64**)a);
+  struct dirent64 *e2 = *((struct dirent64**)b);
 
   // if one of the entries is a directory, it comes first
   if (e1->d_type != e2->d_type) {
@@ -95,127 +438,210 @@ static int dirent_compare(const void *a, const void *b)
 }
 
 
-/// @brief recursively process directory @a dn and print its tree
+/// @brief push directory @a n onto the bottom of deque @a q. The deque grows as needed.
+static void dq_push(struct deque *q, struct dirnode *n)
+{
+  pthread_mutex_lock(&q->lock);
+  if (q->bottom - q->top == q->size) {
+    unsigned long size = q->size ? 2*q->size : 64;
+    struct dirnode **task = malloc(size * sizeof(struct dirnode*));
+    if (task == NULL) panic("ERROR: Cannot allocate memory");
+    for (unsigned long i = q->top; i < q->bottom; i++) task[i % size] = q->task[i % q->size];
+    free(q->task);
+    q->task = task;
+    q->size = size;
+  }
+  q->task[q->bottom++ % q->size] = n;
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+/// @brief take a directory from deque @a q, from the bottom if @a owner is set, otherwise from
+///        the top
 ///
+/// @retval directory on success
+/// @retval NULL if the deque is empty
+static struct dirnode *dq_take(struct deque *q, int owner)
+{
+  struct dirnode *n = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->bottom != q->top) n = owner ? q->task[--q->bottom % q->size] : q->task[q->top++ % q->size];
+  pthread_mutex_unlock(&q->lock);
+
+  return n;
+}
+
+
+/// @brief drop a reference to directory @a r and close it when it was the last one. @a r may be
+///        NULL.
+static void dirref_put(struct dirref *r)
+{
+  if ((r != NULL) && (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0)) {
+    close(r->fd);
+    free(r);
+  }
+}
+
+
+/// @brief create a directory node for @a dn relative to @a parent with prefix @a pstr. Takes
+///        ownership of both strings and of a reference to @a parent.
+static struct dirnode *node_new(struct dirref *parent, char *dn, char *pstr)
+{
+  struct dirnode *n = calloc(1, sizeof(struct dirnode));
+  if (n == NULL) panic("ERROR: Cannot allocate memory");
+
+  n->parent = parent;
+  n->dn = dn;
+  n->pstr = pstr;
+  n->out.fd = -1;
+
+  return n;
+}
+
+
+/// @brief end the current output segment of @a n and follow it by the output of @a child
+static void node_cut(struct dirnode *n, struct dirnode *child)
+{
+  struct segment *seg = realloc(n->seg, (n->nseg + 1) * sizeof(struct segment));
+  if (seg == NULL) panic("ERROR: Cannot allocate memory");
+  n->seg = seg;
+  n->seg[n->nseg++] = (struct segment) { .text = n->out.buf, .len = n->out.len, .child = child };
+
+  n->out = (struct outbuf) { .fd = -1 };
+}
+
+
+/// @brief queue subdirectory @a dn of directory @a dir with prefix @a pstr on the calling thread's
+///        deque. Its output is inserted at the current position of the output of @a parent.
+static void spawn(struct dirnode *parent, struct dirref *dir, char *dn, char *pstr)
+{
+  __atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+  struct dirnode *child = node_new(dir, dn, pstr);
+  node_cut(parent, child);
+  dq_push(&pool.dq[self], child);
+
+  // a sleeping walker either sees the new task or is woken up (both counters are seq_cst)
+  __atomic_add_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool.idle, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_signal(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+  }
+}
+
+
+/// @brief get the next directory for the calling walker: its own newest one, or the oldest one of
+///        another walker. Sleeps while there is no work.
+///
+/// @retval directory to process
+/// @retval NULL if the pool is shut down
+static struct dirnode *next_task(void)
+{
+  for (;;) {
+    for (int i = 0; i < pool.nthreads; i++) {
+      int victim = (self + i) % pool.nthreads;
+      struct dirnode *n = dq_take(&pool.dq[victim], victim == self);
+      if (n != NULL) {
+        __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+        return n;
+      }
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    __atomic_add_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+    while ((__atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) == 0) && !pool.shutdown) {
+      pthread_cond_wait(&pool.work, &pool.lock);
+    }
+    __atomic_sub_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+    int shutdown = pool.shutdown;
+    pthread_mutex_unlock(&pool.lock);
+
+    if (shutdown) return NULL;
+  }
+}
+
+
+/// @brief recursively process directory @a dn and print its tree. Subdirectories are opened and
+///        entries are examined relative to the directory's file descriptor, so no paths are built.
+///
+/// @param dirfd directory @a dn is relative to (AT_FDCWD for the current directory)
 /// @param dn absolute or relative path string
-/// @param pstr prefix string printed in front of each entry
+/// @param pfx prefix printed in front of each entry
 /// @param stats pointer to statistics
 /// @param flags output control flags (F_*)
-void processDir(const char *dn, const char *pstr, struct summary *stats, unsigned int flags)
+/// @param node directory node in parallel mode (subdirectories are queued, not recursed into) or
+///        NULL
+void processDir(int dirfd, const char *dn, struct prefix *pfx, struct summary *stats,
+                unsigned int flags, struct dirnode *node)
 {
   // TODO
+  struct outbuf *out = node ? &node->out : &output;
   // Errors
-  char *error_oom, *pstr_err;
-  if (flags & F_TREE)
-    pstr_err = "`-";
-  else
-    pstr_err = "  ";
-  asprintf(&error_oom, "%s%sERROR: Cannot allocate memory\n", pstr, pstr_err);
+  const char *pstr = pfx->s, *pstr_err = (flags & F_TREE) ? "`-" : "  ";
   errno = 0;
   // open dir
-  DIR *d = opendir(dn);
+  int fd = openat(dirfd, dn, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
   if (errno == EACCES) {
-    printf("%s%sERROR: Permission denied\n", pstr, pstr_err);
+    outPrintf(out, "%s%sERROR: Permission denied\n", pstr, pstr_err);
     errno = 0;
     return;
   }
   else if (errno == ENOENT) {
-    printf("%s%sERROR: No such file or directory\n", pstr, pstr_err);
+    outPrintf(out, "%s%sERROR: No such file or directory\n", pstr, pstr_err);
     errno = 0;
     return;
   }
   else if (errno == ENOMEM) {
-    printf("%s", error_oom);
+    outPrintf(out, "%s%sERROR: Cannot allocate memory\n", pstr, pstr_err);
     errno = 0;
     return;
   }
   else if (errno == ENOTDIR) {
-    printf("%s%sERROR: Not a directory\n", pstr, pstr_err);
+    outPrintf(out, "%s%sERROR: Not a directory\n", pstr, pstr_err);
     errno = 0;
     return;
   }
   else if (errno != 0) {
+    outPrintf(out, "%s%sERROR: %s\n", pstr, pstr_err, strerror(errno));
     errno = 0;
     return;
   }
   // read dirents
-  int num_child = 0;
-  struct dirent **children = (struct dirent **)malloc(MAX_DIR * sizeof(struct dirent*));
-  if (children == NULL) {
-    printf("%s", error_oom);
-    closedir(d);
+  struct dirbuf db;
+  if (readEntries(fd, &db) != 0) {
+    outPrintf(out, "%s%sERROR: Cannot allocate memory\n", pstr, pstr_err);
+    close(fd);
     errno = 0;
     return;
   }
-  // loop reading dirent
-  struct dirent *child;
-  while ((child = getNext(d))) {
-    children[num_child] = (struct dirent*) malloc(child->d_reclen);
-    if (children[num_child] == NULL) {
-      printf("%s", error_oom);
-      for (int i = 0; i < num_child; i++) {
-        free(children[i]);
-      }
-      free(children);
-      closedir(d);
-      errno = 0;
-      return;
-    }
-    memcpy(children[num_child], child, child->d_reclen);
-    num_child++;
-    if (num_child >= MAX_DIR) {
-      children = (struct dirent **)realloc(children, (num_child + MAX_DIR) * sizeof(struct dirent*));
-      if (children == NULL) {
-        printf("%s", error_oom);
-        for (int i = 0; i < num_child; i++) {
-          free(children[i]);
-        }
-        free(children);
-        closedir(d);
-        errno = 0;
-        return;
-      }
+  int num_child = db.n;
+  struct dirent64 **children = db.ent;
+  // some file systems do not report the type in the directory entry; it is needed for sorting
+  for (int i = 0; i < num_child; i++) {
+    struct statx st;
+    if ((children[i]->d_type == DT_UNKNOWN) &&
+        (statx(fd, children[i]->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_TYPE, &st) == 0))
+    {
+      children[i]->d_type = IFTODT(st.stx_mode);
     }
   }
+  errno = 0;
   // sort dirents
-  qsort(children, num_child, sizeof(struct dirent*), dirent_compare);
+  qsort(children, num_child, sizeof(struct dirent64*), dirent_compare);
   // process dirent
+  size_t plen = pfx->len;
+  struct dirref *ref = NULL;  // shared with the queued subdirectories in parallel mode
   for (int i = 0; i < num_child; i++) {
     unsigned char child_dtype = ' ';
     char *child_dname = children[i]->d_name;
+    struct statx child_stat;
 
-    char *new_pstr;
-    char *name;
-    struct stat child_stat;
-    char *child_dir;
-    asprintf(&child_dir, "%s/%s", dn, child_dname);
-
-    // fancy tree view mode
+    // fancy tree view mode connects the entries below to this one unless it is the last child
+    const char *conn = "  ", *indent = "  ";
     if (flags & F_TREE) {
-      if (i < num_child - 1) {
-        // not the last child
-        asprintf(&name, "%s|-%s", pstr, child_dname);
-        // set new_pstr
-        asprintf(&new_pstr, "%s| ", pstr);
-      }
-      else {
-        // the last child
-        asprintf(&name, "%s`-%s", pstr, child_dname);
-        // set new_pstr
-        asprintf(&new_pstr, "%s  ", pstr);\
-      }
-    }
-    // simple mode
-    else {
-      asprintf(&name, "%s  %s", pstr, child_dname);
-      //set new_pstr
-      asprintf(&new_pstr, "%s  ", pstr);
-    }
-    if (flags & F_VERBOSE && strlen(name) > 54) {
-      char tmp[60];
-      strncpy(tmp, name, 51 * sizeof(char));
-      tmp[51] = '\0';
-      asprintf(&name, "%s...", tmp);
+      conn = i < num_child - 1 ? "|-" : "`-";
+      indent = i < num_child - 1 ? "| " : "  ";
     }
     // update summary
     if (children[i]->d_type == DT_REG) {
@@ -244,47 +670,169 @@ void processDir(const char *dn, const char *pstr, struct summary *stats, unsigne
     else if (children[i]->d_type == DT_BLK) {
       child_dtype = 'b';
     }
-    lstat(child_dir, &child_stat);
+    // only the verbose output needs metadata beyond the entry's name and type
+    if (flags & F_VERBOSE) {
+      statx(fd, child_dname, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MASK, &child_stat);
+    }
     if (errno != 0) {
-      printf("%-54s  %s\n", name, "No such file or directory");
+      outName(out, pfx, conn, child_dname, flags & F_VERBOSE, NAME_WIDTH);
+      outPrintf(out, "  %s\n", "No such file or directory");
       errno = 0;
     }
     else {
-      stats->size += child_stat.st_size;
-      stats->blocks += child_stat.st_blocks;
-
       // print child
       if (flags & F_VERBOSE) {
-        char *username = strdup((getpwuid(child_stat.st_uid)->pw_name));
-        char *groupname = strdup((getgrgid(child_stat.st_gid)->gr_name));
-        printf("%-54s  %8s:%-8s  %10ld  %8ld  %1c\n",
-            name,
+        stats->size += child_stat.stx_size;
+        stats->blocks += child_stat.stx_blocks;
+
+        pthread_mutex_lock(&nss_lock);
+        const char *username = idName(&users, child_stat.stx_uid);
+        const char *groupname = idName(&groups, child_stat.stx_gid);
+        pthread_mutex_unlock(&nss_lock);
+        outName(out, pfx, conn, child_dname, 1, NAME_WIDTH);
+        outPrintf(out, "  %8s:%-8s  %10ld  %8ld  %1c\n",
             username,
             groupname,
-            child_stat.st_size,
-            child_stat.st_blocks,
+            (long)child_stat.stx_size,
+            (long)child_stat.stx_blocks,
             child_dtype
         );
       }
       else {
-        printf("%s\n", name);
+        outName(out, pfx, conn, child_dname, 0, 0);
+        outWrite(out, "\n", 1);
       }
     }
     // recursive
     if (children[i]->d_type == DT_DIR) {
-      processDir(child_dir, new_pstr, stats, flags);
+      pfxPush(pfx, indent);
+      if (node) {
+        // queued directories are opened relative to this one, like in the sequential walk, so
+        // that path lengths never matter
+        if (ref == NULL) {
+          if ((ref = malloc(sizeof(struct dirref))) == NULL) panic("ERROR: Cannot allocate memory");
+          *ref = (struct dirref) { .fd = fd, .refs = 1 };
+        }
+        char *child_dir = strdup(child_dname), *child_pstr = strdup(pfx->s);
+        if ((child_dir == NULL) || (child_pstr == NULL)) panic("ERROR: Cannot allocate memory");
+        spawn(node, ref, child_dir, child_pstr);
+      }
+      else processDir(fd, child_dname, pfx, stats, flags, NULL);
+      pfxPop(pfx, plen);
     }
   }
   // finish
-  for (int i = 0; i < num_child; i++) {
-    free(children[i]);
-  }
   free(children);
-  closedir(d);
+  free(db.arena);
+  if (ref != NULL) dirref_put(ref);
+  else close(fd);
   return;
 }
 
 
+/// @brief walker thread: process queued directories until the pool is shut down
+///
+/// @param arg index of the walker
+static void *walker(void *arg)
+{
+  self = (int)(long)arg;
+
+  struct dirnode *n;
+  while ((n = next_task()) != NULL) {
+    struct prefix pfx = { .s = n->pstr, .len = strlen(n->pstr), .cap = strlen(n->pstr) + 1 };
+    processDir(n->parent ? n->parent->fd : AT_FDCWD, n->dn, &pfx, &n->stats, pool.flags, n);
+    dirref_put(n->parent);
+    node_cut(n, NULL);
+    free(n->dn);
+    free(pfx.s);
+
+    pthread_mutex_lock(&pool.lock);
+    n->done = 1;
+    pthread_cond_broadcast(&pool.done);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  return NULL;
+}
+
+
+/// @brief print the output of directory @a n and its subdirectories in the order of the sequential
+///        walk as soon as it becomes available, add their statistics to @a stats, and free them
+static void emit(struct dirnode *n, struct summary *stats)
+{
+  pthread_mutex_lock(&pool.lock);
+  while (!n->done) pthread_cond_wait(&pool.done, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+
+  stats->dirs += n->stats.dirs;
+  stats->files += n->stats.files;
+  stats->links += n->stats.links;
+  stats->fifos += n->stats.fifos;
+  stats->socks += n->stats.socks;
+  stats->size += n->stats.size;
+  stats->blocks += n->stats.blocks;
+
+  for (int i = 0; i < n->nseg; i++) {
+    outWrite(&output, n->seg[i].text, n->seg[i].len);
+    free(n->seg[i].text);
+    if (n->seg[i].child) emit(n->seg[i].child, stats);
+  }
+
+  free(n->seg);
+  free(n);
+}
+
+
+/// @brief process directory @a dn with the walker threads and print its tree. The output is
+///        identical to that of processDir(AT_FDCWD, dn, "", stats, flags, NULL).
+///
+/// @param dn absolute or relative path string
+/// @param stats pointer to statistics
+void walkDir(const char *dn, struct summary *stats)
+{
+  char *root = strdup(dn), *pstr = strdup("");
+  if ((root == NULL) || (pstr == NULL)) panic("ERROR: Cannot allocate memory");
+
+  struct dirnode *n = node_new(NULL, root, pstr);
+  dq_push(&pool.dq[0], n);
+  __atomic_add_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&pool.lock);
+  pthread_cond_signal(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  emit(n, stats);
+}
+
+
+/// @brief start @a nthreads walker threads
+void startPool(int nthreads, unsigned int flags)
+{
+  pool.nthreads = nthreads;
+  pool.flags = flags;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_mutex_init(&pool.dq[i].lock, NULL);
+    if (pthread_create(&pool.thread[i], NULL, walker, (void*)(long)i) != 0) {
+      panic("ERROR: Cannot create walker thread");
+    }
+  }
+}
+
+
+/// @brief terminate the walker threads
+void stopPool(void)
+{
+  pthread_mutex_lock(&pool.lock);
+  pool.shutdown = 1;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 0; i < pool.nthreads; i++) {
+    pthread_join(pool.thread[i], NULL);
+    free(pool.dq[i].task);
+  }
+}
+
+
 /// @brief print program syntax and an optional error message. Aborts the program with EXIT_FAILURE
 ///
 /// @param argv0 command line argument 0 (executable)
@@ -292,6 +840,8 @@ void processDir(const char *dn, const char *pstr, struct summary *stats, unsigne
 /// @param ... parameter to the error format string
 void syntax(const char *argv0, const char *error, ...)
 {
+  outFlush(&output);
+
   if (error) {
     va_list ap;
 
@@ -304,7 +854,7 @@ void syntax(const char *argv0, const char *error, ...)
 
   assert(argv0 != NULL);
 
-  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-h] [path...]\n"
+  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-j N] [-h] [path...]\n"
                   "Gather information about directory trees. If no path is given, the current directory\n"
                   "is analyzed.\n"
                   "\n"
@@ -312,9 +862,10 @@ void syntax(const char *argv0, const char *error, ...)
                   " -t        print the directory tree (default if no other option specified)\n"
                   " -s        print summary of directories (total number of files, total file size, etc)\n"
                   " -v        print detailed information for each file. Turns on tree view.\n"
+                  " -j N      walk the tree with N threads (max %d). The output is the same.\n"
                   " -h        print this help\n"
                   " path...   list of space-separated paths (max %d). Default is the current directory.\n",
-                  basename(argv0), MAX_DIR);
+                  basename(argv0), MAX_THREADS, MAX_DIR);
 
   exit(EXIT_FAILURE);
 }
@@ -332,6 +883,8 @@ int main(int argc, char *argv[])
 
   struct summary dstat, tstat;
   unsigned int flags = 0;
+  int nthreads = 1;
+  struct prefix pfx = { 0 };
 
   //
   // parse arguments
@@ -343,13 +896,18 @@ int main(int argc, char *argv[])
       else if (!strcmp(argv[i], "-s")) flags |= F_SUMMARY;
       else if (!strcmp(argv[i], "-v")) flags |= F_VERBOSE;
       else if (!strcmp(argv[i], "-h")) syntax(argv[0], NULL);
+      else if (!strcmp(argv[i], "-j")) {
+        if ((i + 1 == argc) || ((nthreads = atoi(argv[++i])) < 1) || (nthreads > MAX_THREADS)) {
+          syntax(argv[0], "Option -j requires a number of threads between 1 and %d.", MAX_THREADS);
+        }
+      }
       else syntax(argv[0], "Unrecognized option '%s'.", argv[i]);
     } else {
       // anything else is recognized as a directory
       if (ndir < MAX_DIR) {
         directories[ndir++] = argv[i];
       } else {
-        printf("Warning: maximum number of directories exceeded, ignoring '%s'.\n", argv[i]);
+        outPrintf(&output, "Warning: maximum number of directories exceeded, ignoring '%s'.\n", argv[i]);
       }
     }
   }
@@ -363,32 +921,35 @@ int main(int argc, char *argv[])
   //
   // TODO
   tstat = (struct summary) {.blocks=0, .dirs=0, .fifos=0, .files=0, .links=0, .size=0, .socks=0};
+  if (nthreads > 1) startPool(nthreads, flags);
+  pfxPush(&pfx, "");
   for (int i = 0; i < ndir; i++) {
     dstat = (struct summary) {.blocks=0, .dirs=0, .fifos=0, .files=0, .links=0, .size=0, .socks=0};
     if (flags & F_SUMMARY) {
       if (flags & F_VERBOSE) {
-        printf("%-60s%-10s %14s%15s \n", "Name", "User:Group", "Size", "Blocks Type");
+        outPrintf(&output, "%-60s%-10s %14s%15s \n", "Name", "User:Group", "Size", "Blocks Type");
       }
       else {
-        printf("Name\n");
+        outPrintf(&output, "Name\n");
       }
-      printf("----------------------------------------------------------------------------------------------------\n");
+      outPrintf(&output, "----------------------------------------------------------------------------------------------------\n");
     }
-    printf("%s\n", directories[i]);
-    processDir(directories[i], "", &dstat, flags);
+    outPrintf(&output, "%s\n", directories[i]);
+    if (nthreads > 1) walkDir(directories[i], &dstat);
+    else processDir(AT_FDCWD, directories[i], &pfx, &dstat, flags, NULL);
     if (flags & F_SUMMARY)
-      printf("----------------------------------------------------------------------------------------------------\n");
+      outPrintf(&output, "----------------------------------------------------------------------------------------------------\n");
 
     // print summary
     if (flags & F_SUMMARY) {
-      char *str_file, *str_dir, *str_link, *str_pipe, *str_sock, *str_summary;
+      char *str_file, *str_dir, *str_link, *str_pipe, *str_sock, str_summary[256];
       //
       str_file = dstat.files == 1 ? "file" : "files";
       str_dir = dstat.dirs == 1 ? "directory" : "directories";
       str_link = dstat.links == 1 ? "link" : "links";
       str_pipe = dstat.fifos == 1 ? "pipe" : "pipes";
       str_sock = dstat.socks == 1 ? "socket" : "sockets";
-      asprintf(&str_summary, "%d %s, %d %s, %d %s, %d %s, and %d %s",
+      snprintf(str_summary, sizeof(str_summary), "%d %s, %d %s, %d %s, %d %s, and %d %s",
           dstat.files, str_file,
           dstat.dirs, str_dir,
           dstat.links, str_link,
@@ -396,10 +957,10 @@ int main(int argc, char *argv[])
           dstat.socks, str_sock
       );
       if (flags & F_VERBOSE)
-        printf("%-68s   %14lld %9lld\n", str_summary, dstat.size, dstat.blocks);
+        outPrintf(&output, "%-68s   %14lld %9lld\n", str_summary, dstat.size, dstat.blocks);
       else
-        printf("%s\n", str_summary);
-      printf("\n");
+        outPrintf(&output, "%s\n", str_summary);
+      outPrintf(&output, "\n");
     }
 
     // aggregate summary
@@ -415,7 +976,7 @@ int main(int argc, char *argv[])
   // print grand total
   //
   if ((flags & F_SUMMARY) && (ndir > 1)) {
-    printf("Analyzed %d directories:\n"
+    outPrintf(&output, "Analyzed %d directories:\n"
            "  total # of files:        %16d\n"
            "  total # of directories:  %16d\n"
            "  total # of links:        %16d\n"
@@ -424,13 +985,20 @@ int main(int argc, char *argv[])
            ndir, tstat.files, tstat.dirs, tstat.links, tstat.fifos, tstat.socks);
 
     if (flags & F_VERBOSE) {
-      printf("  total file size:         %16llu\n"
+      outPrintf(&output, "  total file size:         %16llu\n"
              "  total # of blocks:       %16llu\n",
              tstat.size, tstat.blocks);
     }
 
   }
 
+  if (nthreads > 1) stopPool();
+  outFlush(&output);
+  free(output.buf);
+  free(pfx.s);
+  idFree(&users);
+  idFree(&groups);
+
   //
   // that's all, folks
   //
@@ -0,0 +1,68 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# System Programming                         I/O Lab                                    Fall 2021
+#
+# script to compare the parallel walk (dirtree -j) with the sequential walk
+#
+# Usage: jtest.sh [directory...]
+#   Runs dirtree with every option combination on the given directories (default: the test trees
+#   generated by gentree.sh and /etc) and on a generated tree that is DEEP_LEVELS directories deep,
+#   once sequentially and once with each number of threads in THREADS. The outputs must be
+#   identical. The paths of the deep tree exceed PATH_MAX, so it only passes if both walks open
+#   directories relative to their parent.
+#
+# Author: Changmin Choi
+#
+
+DIRTREE=${0%/*}/../dirtree
+THREADS="1 4 16"
+DEEP_LEVELS=300
+DEEP_NAME=level-directory-000000 # 22 characters, the last ones replaced by the level
+
+OPTIONS=("" "-t" "-s" "-v" "-t -s" "-s -v" "-v -t" "-t -s -v")
+
+if [[ ! -x $DIRTREE ]]; then
+  echo "Cannot find '$DIRTREE', run 'make' first."
+  exit 1
+fi
+
+if [[ $# -gt 0 ]]; then
+  DIRS=("$@")
+else
+  DIRS=()
+  for d in ${0%/*}/test? ${0%/*}/demo /etc; do
+    [[ -d $d ]] && DIRS+=($d)
+  done
+fi
+
+# generate the deep tree level by level: its paths are too long for mkdir -p
+TMPDIR=`mktemp -d`
+trap "rm -rf $TMPDIR" EXIT
+(
+  cd $TMPDIR && mkdir deep && cd deep || exit 1
+  for (( l = 0 ; l < $DEEP_LEVELS ; l++ )); do
+    name=${DEEP_NAME:0:-${#l}}$l
+    echo $l > file && ln -s file link && mkdir $name && cd $name || exit 1
+  done
+) || { echo "Cannot generate the deep tree in '$TMPDIR'."; exit 1; }
+DIRS+=($TMPDIR/deep)
+
+TOTAL=0
+PASS=0
+for dir in "${DIRS[@]}"; do
+  for opt in "${OPTIONS[@]}"; do
+    EXPECTED=`$DIRTREE $opt $dir 2>&1`
+    for j in $THREADS; do
+      OUTPUT=`$DIRTREE -j $j $opt $dir 2>&1`
+      TOTAL=$(($TOTAL + 1))
+      if [[ "$OUTPUT" == "$EXPECTED" ]]; then
+        PASS=$(($PASS + 1))
+      else
+        echo "FAIL: -j $j $opt $dir"
+      fi
+    done
+  done
+done
+echo "RESULT: ${PASS}/${TOTAL}"
+
+[[ $PASS == $TOTAL ]]
@@ -69,30 +69,100 @@
 // ds_release() releases all memory and resets all internal variables. A subsequent call to
 // ds_allocate() is supported and initializes a 'fresh' heap.
 //
+// File-backed data segment:
+// -------------------------
+// After ds_setfile(), ds_allocate() maps the heap area MAP_SHARED from a file instead of
+// anonymous memory, so that the heap survives the process. The file starts with one page of
+// metadata (DSFileHeader) followed by the heap area:
+//
+//    file offset 0                PAGESIZE                              PAGESIZE + max_heap_size
+//    +----------------------------+----------------------------------------+
+//    | DSFileHeader | client meta |                 heap                   |
+//    +----------------------------+----------------------------------------+
+//
+// The metadata page is mapped separately (not adjacent to the heap) so that the guard pages
+// around the heap stay intact. It records the heap size, the current brk, and the address at
+// which the heap was last mapped. If the file already contains a data segment of the same size,
+// ds_allocate() restores its brk instead of starting empty (see ds_restored()). The heap is mapped
+// at the requested base, else at the previous address if that is available, else anywhere; in the
+// latter case the heap has been relocated. The client meta area (ds_getmeta()) lets the memory
+// manager persist its own state.
+//
+// Multiple data segments:
+// -----------------------
+// ds_allocate() and ds_release() manage the default data segment. Additional, independent data
+// segments are created with ds_create() and released with ds_destroy(). All other functions operate
+// on the calling thread's current data segment, which is the default one unless another segment
+// has been selected with ds_select(). Each thread (or arena) can thus grow its own segment.
+//
+// Concurrency:
+// ------------
+// ds_sbrk() may be called concurrently on the same data segment. The brk is bumped with a single
+// compare-and-swap, so every call gets a distinct range and no update is lost. Protection changes
+// are serialized by a per-segment mutex: after moving the brk, ds_sbrk() takes the lock and
+// adjusts the protection of the pages between the previously read/write end (prot_end) and the
+// current brk, whichever call moved it there. The read/write area thus always converges to the
+// brk, and only the pages that change are mprotect()ed. Pages below the brk are never revoked,
+// not even temporarily. Creating, destroying, and selecting segments are not synchronized with
+// ds_sbrk() calls on the same segment.
+//
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "dataseg.h"
-
-
-static void *ds_start = NULL;       ///< start of the data segment
-static void *ds_end   = NULL;       ///< end of the data segment
-static void *ds_heap_start = NULL;  ///< start of the user space heap
-static void *ds_heap_brk   = NULL;  ///< current logical end of the user space heap
-static void *ds_heap_end   = NULL;  ///< end of the user space heap
+#include "trace.h"
+
+
+#define DS_MAGIC      "CSAPDS01"    ///< magic number of a file-backed data segment
+#define DS_META_SIZE  256           ///< size of client meta area in file header
+
+/// @brief header of a file-backed data segment (first page of the file)
+typedef struct {
+  char   magic[8];                  ///< DS_MAGIC
+  size_t max_heap_size;             ///< size of the heap area
+  size_t brk;                       ///< current brk as offset from the start of the heap
+  void   *base;                     ///< address at which the heap was last mapped
+  char   meta[DS_META_SIZE];        ///< client meta area
+} DSFileHeader;
+
+/// @brief a simulated data segment
+struct DataSegment {
+  void   *start;                    ///< start of the data segment
+  void   *end;                      ///< end of the data segment
+  void   *heap_start;               ///< start of the user space heap
+  void   *heap_brk;                 ///< current logical end of the user space heap (atomic)
+  void   *heap_end;                 ///< end of the user space heap
+  void   *prot_end;                 ///< end of the read/write area, page aligned (under lock)
+  ssize_t num_sbrk;                 ///< number of times ds_sbrk() was called with a non-zero
+                                    ///< argument (atomic)
+  pthread_mutex_t lock;             ///< serializes protection changes and brk persistence
+  int    fd;                        ///< file descriptor of backing file (-1: anonymous)
+  DSFileHeader *hdr;                ///< mapped file header (NULL: anonymous)
+  int    isrestored;                ///< heap restored from file (yes: 1, relocated: 2, otherwise 0)
+};
+
+static DataSegment ds_default = {   ///< data segment managed by ds_allocate()/ds_release()
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .fd = -1,
+};
+static __thread DataSegment *ds_current __attribute__((tls_model("initial-exec"))) = NULL;
+                                    ///< segment selected by the calling thread (NULL: default)
 static int  PAGESIZE  = 0;          ///< (system) page size
-static int  ds_initialized = 0;     ///< initialized flag (yes: 1, otherwise 0)
 static int  ds_loglevel    = 0;     ///< log level (0: off; 1: info; 2: verbose)
 static int  ds_domprotect  = 1;     ///< mprotect() heap areas (0: off, 1: on)
-static ssize_t ds_num_sbrk = 0;     ///< number of times ds_sbrk() was called with a non-zero 
-                                    ///< argument
+
+static char *ds_file = NULL;        ///< backing file (NULL: anonymous memory)
+static void *ds_file_base = NULL;   ///< requested heap address for file-backed segment
 
 
 /// @brief print a log message if level <= ds_loglevel. The variadic argument is a printf format
@@ -122,19 +192,91 @@ static void ds_log(int level, ...)
   #define LOG(level, ...)
 #endif
 
-void ds_allocate(size_t max_heap_size)
+/// @brief data segment the implicit functions of the calling thread operate on
+static DataSegment* ds_cur(void)
 {
-  LOG(1, "ds_allocate(%lx)", max_heap_size);
+  return ds_current != NULL ? ds_current : &ds_default;
+}
 
-  if (ds_start != NULL) ds_release();
+/// @brief map the heap area of the data segment @a ds from the backing file ds_file. Terminates
+///        the process on error.
+/// @param ds data segment
+/// @param max_heap_size size of heap area
+/// @param ds_size size of entire data segment including guard pages
+static void ds_map_file(DataSegment *ds, size_t max_heap_size, size_t ds_size)
+{
+  LOG(2, "  mapping heap from '%s'", ds_file);
 
+  ds->fd = open(ds_file, O_RDWR|O_CREAT, 0600);
+  struct stat st;
+  if ((ds->fd < 0) || (fstat(ds->fd, &st) < 0)) {
+    fprintf(stderr, "ERROR: cannot open '%s' in %s: %s.\n", ds_file, __func__, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  ds->hdr = mmap(NULL, PAGESIZE, PROT_READ|PROT_WRITE, MAP_SHARED, ds->fd, 0);
+  if ((ds->hdr == MAP_FAILED) || (ftruncate(ds->fd, PAGESIZE + max_heap_size) < 0)) {
+    fprintf(stderr, "ERROR: cannot map '%s' in %s: %s.\n", ds_file, __func__, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  int valid = (st.st_size >= PAGESIZE) &&
+              (memcmp(ds->hdr->magic, DS_MAGIC, sizeof(ds->hdr->magic)) == 0) &&
+              (ds->hdr->max_heap_size == max_heap_size) && (ds->hdr->brk <= max_heap_size);
+
+  // reserve the address range: requested base, else previous base, else anywhere
+  void *base = ds_file_base ? ds_file_base : (valid ? ds->hdr->base : NULL);
+  ds->start = (void*)-1;
+  if (base != NULL) {
+    ds->start = mmap(base - PAGESIZE, ds_size, PROT_NONE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED_NOREPLACE, -1, 0);
+    if ((ds->start != (void*)-1) && (ds->start != base - PAGESIZE)) {
+      munmap(ds->start, ds_size);
+      ds->start = (void*)-1;
+    }
+    if ((ds->start == (void*)-1) && (ds_file_base != NULL)) {
+      fprintf(stderr, "ERROR: cannot map heap at %p in %s.\n", ds_file_base, __func__);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (ds->start == (void*)-1) {
+    ds->start = mmap(NULL, ds_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  }
+  if ((ds->start == (void*)-1) ||
+      (mmap(ds->start + PAGESIZE, max_heap_size, PROT_NONE, MAP_SHARED|MAP_FIXED, ds->fd, PAGESIZE)
+       == MAP_FAILED))
+  {
+    fprintf(stderr, "ERROR: cannot map memory in %s: %s.\n", __func__, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (valid) {
+    ds->isrestored = ds->hdr->base == ds->start + PAGESIZE ? 1 : 2;
+  } else {
+    memset(ds->hdr, 0, sizeof(*ds->hdr));
+    memcpy(ds->hdr->magic, DS_MAGIC, sizeof(ds->hdr->magic));
+    ds->hdr->max_heap_size = max_heap_size;
+    ds->isrestored = 0;
+  }
+  ds->hdr->base = ds->start + PAGESIZE;
+}
+
+/// @brief allocate and initialize the data segment @a ds. Terminates the process on error.
+/// @param ds data segment (released)
+/// @param max_heap_size maximum possible size of heap data segment
+static void ds_init(DataSegment *ds, size_t max_heap_size)
+{
   PAGESIZE = getpagesize();
   size_t ds_size = max_heap_size + 2*PAGESIZE;
 
   // allocate memory for the data segment
   LOG(2, "  allocating %lx bytes of memory", ds_size);
-  ds_start = mmap(NULL, ds_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
-  if (ds_start == (void*)-1) {
+  if (ds_file != NULL) {
+    ds_map_file(ds, max_heap_size, ds_size);
+  } else {
+    ds->start = mmap(NULL, ds_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  }
+  if (ds->start == (void*)-1) {
     fprintf(stderr, "ERROR: cannot map memory in %s: %s.\n",
                     __func__, strerror(errno));
     exit(EXIT_FAILURE);
@@ -143,19 +285,28 @@ void ds_allocate(size_t max_heap_size)
   // try to lock the memory in RAM. Print only a warning if we don't succeed.
   /* don't do this for now. Requires changing resource limits in VM.
   LOG(2, "  locking memory in DRAM...", ds_size);
-  if (mlock(ds_start, ds_size) < 0) {
+  if (mlock(ds->start, ds_size) < 0) {
     fprintf(stderr, "WARNING: cannot lock memory in %s: %s.\n",
                     __func__, strerror(errno));
   }
   */
 
   // initalize pointers
-  ds_end         = ds_start + ds_size;
-  ds_heap_start  = ds_start + PAGESIZE;
-  ds_heap_brk    = ds_heap_start;
-  ds_heap_end    = ds_end - PAGESIZE;
-  ds_initialized = 1;
-  ds_num_sbrk    = 0;
+  ds->end        = ds->start + ds_size;
+  ds->heap_start = ds->start + PAGESIZE;
+  ds->heap_brk   = ds->heap_start;
+  ds->heap_end   = ds->end - PAGESIZE;
+  ds->prot_end   = ds->heap_start;
+  ds->num_sbrk   = 0;
+
+  // restore brk of a file-backed heap
+  if (ds->isrestored) {
+    ds->heap_brk = ds->heap_start + ds->hdr->brk;
+    if (ds->hdr->brk > 0) {
+      mprotect(ds->heap_start, ds->hdr->brk, PROT_READ|PROT_WRITE);
+      ds->prot_end = (void*)(((unsigned long)ds->heap_brk + PAGESIZE - 1) / PAGESIZE * PAGESIZE);
+    }
+  }
 
   LOG(2, "  ds_start:           %p\n"
          "  ds_heap_start:      %p\n"
@@ -163,7 +314,73 @@ void ds_allocate(size_t max_heap_size)
          "  ds_heap_end:        %p\n"
          "  ds_end:             %p\n"
          "  PAGESIZE:           %d\n",
-         ds_start, ds_heap_start, ds_heap_brk, ds_heap_end, ds_end, PAGESIZE);
+         ds->start, ds->heap_start, ds->heap_brk, ds->heap_end, ds->end, PAGESIZE);
+}
+
+/// @brief release the memory and the backing file of data segment @a ds and reset its state
+static void ds_fini(DataSegment *ds)
+{
+  if (ds->start != NULL) {
+    // unlock & release memory. Ignore error message here.
+    //munlock(ds->start, ds->end-ds->start);
+    munmap(ds->start, ds->end-ds->start);
+  }
+  if (ds->hdr != NULL) munmap(ds->hdr, PAGESIZE);
+  if (ds->fd >= 0) close(ds->fd);
+  ds->hdr = NULL;
+  ds->fd = -1;
+  ds->isrestored = 0;
+
+  ds->start = ds->end = ds->heap_start = ds->heap_brk = ds->heap_end = ds->prot_end = NULL;
+}
+
+/// @brief bring the memory protection and the persisted brk of @a ds up to date with its current
+///        brk. Concurrent callers are serialized; each one applies whatever the brk is when it
+///        gets the lock, so the read/write area converges to the brk of the last ds_sbrk().
+///        Terminates the process if the protection cannot be changed.
+static void ds_sync(DataSegment *ds)
+{
+  pthread_mutex_lock(&ds->lock);
+
+  void *brk = __atomic_load_n(&ds->heap_brk, __ATOMIC_ACQUIRE);
+
+  if (ds_domprotect) {
+    // since we are not forcing alignment of brk at PAGESIZE, the page containing brk stays
+    // accessible. Only pages entirely above brk are revoked so that pages holding valid data
+    // never lose their permissions, not even temporarily (other threads may be accessing them)
+    void *aligned_brk = (void*)((((unsigned long)brk) + PAGESIZE - 1) / PAGESIZE * PAGESIZE);
+    int res = 0;
+
+    LOG(2, "  setting memory protection: %s from %p to %p\n",
+        aligned_brk > ds->prot_end ? "READ/WRITE" : "NO ACCESS",
+        aligned_brk > ds->prot_end ? ds->prot_end : aligned_brk,
+        aligned_brk > ds->prot_end ? aligned_brk : ds->prot_end);
+
+    if (aligned_brk > ds->prot_end) {
+      res = mprotect(ds->prot_end, aligned_brk - ds->prot_end, PROT_READ|PROT_WRITE);
+    } else if (aligned_brk < ds->prot_end) {
+      res = mprotect(aligned_brk, ds->prot_end - aligned_brk, PROT_NONE);
+    }
+    if (res != 0) {
+      fprintf(stderr, "ERROR: cannot set memory protection flags in %s: %s.\n",
+          __func__, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    ds->prot_end = aligned_brk;
+  }
+
+  if (ds->hdr != NULL) ds->hdr->brk = brk - ds->heap_start;
+
+  pthread_mutex_unlock(&ds->lock);
+}
+
+void ds_allocate(size_t max_heap_size)
+{
+  LOG(1, "ds_allocate(%lx)", max_heap_size);
+
+  if (ds_default.start != NULL) ds_release();
+
+  ds_init(&ds_default, max_heap_size);
 }
 
 
@@ -171,58 +388,76 @@ void ds_release(void)
 {
   LOG(1, "ds_release()");
 
-  if (ds_start != NULL) {
-    // unlock & release memory. Ignore error message here.
-    //munlock(ds_start, ds_end-ds_start);
-    munmap(ds_start, ds_end-ds_start);
+  ds_fini(&ds_default);
+}
+
+
+DataSegment* ds_create(size_t max_heap_size)
+{
+  LOG(1, "ds_create(%lx)", max_heap_size);
+
+  DataSegment *ds = calloc(1, sizeof(DataSegment));
+  if (ds == NULL) {
+    fprintf(stderr, "ERROR: cannot allocate data segment in %s: %s.\n", __func__, strerror(errno));
+    exit(EXIT_FAILURE);
   }
+  pthread_mutex_init(&ds->lock, NULL);
+  ds->fd = -1;
+
+  ds_init(ds, max_heap_size);
+
+  return ds;
+}
+
+
+void ds_destroy(DataSegment *ds)
+{
+  LOG(1, "ds_destroy(%p)", ds);
+
+  if ((ds == NULL) || (ds == &ds_default)) return;
 
-  ds_start = ds_end = ds_heap_start = ds_heap_brk = ds_heap_end = NULL;
-  PAGESIZE = 0;
-  ds_initialized = 0;
+  if (ds_current == ds) ds_current = NULL;
+  ds_fini(ds);
+  pthread_mutex_destroy(&ds->lock);
+  free(ds);
+}
+
+
+DataSegment* ds_select(DataSegment *ds)
+{
+  DataSegment *prev = ds_cur();
+  ds_current = ds != &ds_default ? ds : NULL;
+  return prev;
 }
 
 
 void* ds_sbrk(intptr_t increment)
 {
   LOG(1, "ds_sbrk(%c0x%lx)", increment < 0 ? '-' : '+', labs(increment));
-  assert(ds_initialized);
-
-  void *old_heap_brk = ds_heap_brk;
-
-  if (increment != 0) {
-    ds_heap_brk += increment;
-    ds_num_sbrk++;
-
-    if ((ds_heap_start <= ds_heap_brk) && (ds_heap_brk < ds_heap_end)) {
-      if (ds_domprotect) {
-        // adjust memory access permissions
-        // since we are not forcing alignment of brk at PAGESIZE, we need to mark the invalid part
-        // before allowing access to the permissible area because permissions are set on a page-level
-        // basis
-        LOG(2, "  setting memory protection:\n"
-            "    READ/WRITE from %p to %p\n"
-            "    NO ACCESS  from %p to %p\n",
-            ds_heap_start, ds_heap_brk, ds_heap_brk, ds_end);
-
-        void *aligned_brk = (void*)(((unsigned long)ds_heap_brk) / PAGESIZE * PAGESIZE); // round down
-
-        if ((mprotect(aligned_brk, ds_end-aligned_brk, PROT_NONE) != 0) ||
-            (mprotect(ds_heap_start, ds_heap_brk-ds_heap_start, PROT_READ|PROT_WRITE) != 0))
-        {
-          fprintf(stderr, "ERROR: cannot set memory protection flags in %s: %s.\n", 
-              __func__, strerror(errno));
-          exit(EXIT_FAILURE);
-        }
-      }
-    } else {
-      // ignore increment and signal an error if we ended up outside the simulated data segment
+
+  DataSegment *ds = ds_cur();
+  assert(ds->start != NULL);
+
+  void *old_heap_brk = __atomic_load_n(&ds->heap_brk, __ATOMIC_RELAXED);
+  if (increment == 0) return old_heap_brk;
+
+  __atomic_add_fetch(&ds->num_sbrk, 1, __ATOMIC_RELAXED);
+
+  // move brk atomically; a concurrent call that moved it first makes the CAS fail and we retry
+  // with its brk. Signal an error if we would end up outside the simulated data segment.
+  void *new_heap_brk;
+  do {
+    new_heap_brk = old_heap_brk + increment;
+    if ((new_heap_brk < ds->heap_start) || (new_heap_brk >= ds->heap_end)) {
       LOG(1, "  invalid increment (ended up outside valid data segment)");
       errno = ENOMEM;
-      ds_heap_brk = old_heap_brk;
-      old_heap_brk = (void*)-1;
+      return (void*)-1;
     }
-  }
+  } while (!__atomic_compare_exchange_n(&ds->heap_brk, &old_heap_brk, new_heap_brk, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  if (ds_domprotect || (ds->hdr != NULL)) ds_sync(ds);
+  TRACE(tr_Sbrk, old_heap_brk, increment, 0);
 
   return old_heap_brk;
 }
@@ -230,7 +465,7 @@ void* ds_sbrk(intptr_t increment)
 
 int ds_getpagesize(void)
 {
-  assert(ds_initialized);
+  assert(ds_cur()->start != NULL);
 
   return PAGESIZE;
 }
@@ -238,15 +473,17 @@ int ds_getpagesize(void)
 
 void ds_heap_stat(void **start, void **brk, void **end)
 {
-  if (start) *start = ds_heap_start;
-  if (brk)   *brk   = ds_heap_brk;
-  if (end)   *end   = ds_heap_end;
+  DataSegment *ds = ds_cur();
+
+  if (start) *start = ds->heap_start;
+  if (brk)   *brk   = __atomic_load_n(&ds->heap_brk, __ATOMIC_ACQUIRE);
+  if (end)   *end   = ds->heap_end;
 }
 
 
 ssize_t ds_getnsbrk(void)
 {
-  return ds_num_sbrk;
+  return __atomic_load_n(&ds_cur()->num_sbrk, __ATOMIC_RELAXED);
 }
 
 void ds_setloglevel(int level)
@@ -261,3 +498,24 @@ void ds_setmprotect(int active)
 }
 
 
+void ds_setfile(const char *path, void *base)
+{
+  free(ds_file);
+  ds_file = path != NULL ? strdup(path) : NULL;
+  ds_file_base = base;
+}
+
+
+int ds_restored(void)
+{
+  return ds_cur()->isrestored;
+}
+
+
+void* ds_getmeta(size_t *size)
+{
+  DSFileHeader *hdr = ds_cur()->hdr;
+
+  if (size) *size = hdr != NULL ? sizeof(hdr->meta) : 0;
+  return hdr != NULL ? hdr->meta : NULL;
+}
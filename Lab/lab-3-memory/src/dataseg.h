@@ -36,6 +36,9 @@
 
 #include <unistd.h>
 
+/// @brief a simulated data segment (opaque)
+typedef struct DataSegment DataSegment;
+
 /// @brief initialize simulated data segment. Allocates & locks memory pages in RAM to minimize
 ///        performance variance.
 /// @param max_heap_size maximum possible size of heap data segment
@@ -44,8 +47,27 @@ void ds_allocate(size_t max_heap_size);
 /// @brief release simulated data segment
 void ds_release(void);
 
+/// @brief create an additional data segment that coexists with the default one (and with other
+///        segments created by ds_create()). Use ds_select() to operate on it.
+/// @param max_heap_size maximum possible size of heap data segment
+/// @retval DataSegment* the new data segment. Terminates the process on error.
+DataSegment* ds_create(size_t max_heap_size);
+
+/// @brief release a data segment created by ds_create(). If it is the calling thread's current
+///        segment, the thread reverts to the default segment.
+/// @param ds data segment (NULL: no-op)
+void ds_destroy(DataSegment *ds);
+
+/// @brief select the data segment the calling thread operates on. All other ds_* functions
+///        (except ds_allocate()/ds_release(), which always manage the default segment) act on the
+///        current segment of the calling thread; initially, that is the default segment.
+/// @param ds data segment (NULL: default segment)
+/// @retval DataSegment* previously selected data segment
+DataSegment* ds_select(DataSegment *ds);
+
 /// @brief sbrk() implementation on our simulated data segment. Operates exactly as the kernel's
-///        sbrk() function (see man sbrk)
+///        sbrk() function (see man sbrk). Thread-safe: concurrent calls on the same data segment
+///        receive disjoint ranges.
 /// @param increment offset by which to increase/decrease current brk.
 /// @retval old brk on success.
 /// @retval (void*)-1 on error. errno is set to ENOMEM
@@ -75,4 +97,25 @@ void ds_setloglevel(int level);
 /// @brief active (1: mprotect() activated, 0: mprotect() not executed)
 void ds_setmprotect(int active);
 
+/// @brief back the next data segments allocated by ds_allocate() with a file (MAP_SHARED) instead
+///        of anonymous memory. If the file holds a data segment of the same size, its heap contents
+///        and brk are restored.
+/// @param path backing file (created if necessary). NULL reverts to anonymous memory.
+/// @param base address at which the heap must start. NULL: the address used last time if
+///             available, otherwise anywhere (relocation)
+void ds_setfile(const char *path, void *base);
+
+/// @brief check whether ds_allocate() restored an existing file-backed heap
+/// @retval 0 heap is new (or anonymous)
+/// @retval 1 heap restored at the same address as before
+/// @retval 2 heap restored at a different address (relocated)
+int ds_restored(void);
+
+/// @brief retrieve the client meta area of a file-backed data segment. The memory manager uses it
+///        to persist its own state across restarts.
+/// @param[out] size size of the meta area in bytes
+/// @retval void* pointer to the meta area
+/// @retval NULL if the data segment is not file-backed
+void* ds_getmeta(size_t *size);
+
 #endif // __DATSEG_H__
@@ -0,0 +1,344 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief malloc() replacement library (libmm.so) backed by the dynamic memory manager
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+//
+// libmm.so
+// ========
+// Exports the standard allocation functions so that unmodified programs can run on top of the
+// memory manager:
+//
+//   LD_PRELOAD=./libmm.so ls -l
+//
+// Environment variables (read once, on the first allocation):
+//   MM_POLICY     firstfit, nextfit, bestfit, buddy, or tlsf (default)
+//   MM_HEAPSIZE   maximal heap size in bytes (default 16 GB). The address range is only reserved;
+//                 pages are backed by memory as the heap grows
+//   MM_GROWTH     <chunk>[,<shift>[,<cap>]]: heap growth policy (mm_setgrowth()), e.g. 1048576,2
+//                 to extend the heap by at least 1 MB or a quarter of the used heap
+//   MM_TRACE      if set, trace all allocator events (tr_start()) and write the trace to the given
+//                 file at exit. Decode it with mm_tracedump
+//
+// Thread safety: all calls are serialized by one mutex. The thread holding it becomes the owner
+// of the heap (mm_setowner()), so frees are never deferred to the remote-free stack.
+//
+// Reentrancy: functions called while the heap is being initialized (pthread_atfork(), for
+// example) may allocate memory themselves. Such nested calls are detected with a thread-local
+// flag and served from a small static bootstrap area; freeing bootstrap memory is a no-op.
+//
+// Alignment: memmgr payloads are only 8-byte aligned (header word in front of a block aligned to
+// the granule of 16 bytes or more), but malloc() must return memory aligned for any type
+// (16 bytes). Every allocation is therefore shifted forward within its block, and the word in
+// front of the returned pointer holds the shift with bit 2 set and the allocated bit clear. This
+// distinguishes it from a block header and lets free() and realloc() find the payload returned
+// by memmgr:
+//
+//      payload (memmgr)    ptr (returned, 16-byte or more aligned)
+//      |                   |
+//   +---+----- ... -----+---+------------------------------ ... ---+---+
+//   | H |   (padding)   | M |  user data                            | F |
+//   +---+----- ... -----+---+------------------------------ ... ---+---+
+//                         M = (ptr - payload) | 0x4
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+#include "trace.h"
+
+#define EXPORT             __attribute__((visibility("default")))  ///< exported symbol
+#define MIN_ALIGN          16                          ///< alignment of malloc() results
+#define SHIFT_FLAG         ((uintptr_t)0x4)            ///< marks shift word in front of ptr
+#define STATUS_MASK        ((uintptr_t)0x7)            ///< status bits of a header/shift word
+#define DEFAULT_HEAPSIZE   (16UL << 30)                ///< default maximal heap size
+#define BOOTSTRAP_SIZE     (64 << 10)                  ///< size of bootstrap area
+
+/// @name global variables
+/// @{
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;  ///< serializes all calls
+static int mm_ready = 0;                               ///< heap initialized
+static __thread int mm_busy __attribute__((tls_model("initial-exec"))) = 0; ///< in init (nested)
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(MIN_ALIGN)));  ///< bootstrap area
+static size_t bootstrap_used = 0;                      ///< bytes used in bootstrap area
+static const char *trace_file = NULL;                  ///< MM_TRACE (NULL: no tracing)
+/// @}
+
+
+/// @brief fork handlers: hold the lock across fork() so that the child's copy is consistent
+static void lock_prepare(void) { pthread_mutex_lock(&mm_lock); }
+static void lock_parent(void)  { pthread_mutex_unlock(&mm_lock); }
+static void lock_child(void)   { pthread_mutex_init(&mm_lock, NULL); }
+
+/// @brief exit handler: write the trace to MM_TRACE
+static void trace_exit(void)
+{
+  pthread_mutex_lock(&mm_lock);
+  tr_stop();
+  int fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    tr_dump(fd);
+    close(fd);
+  }
+  pthread_mutex_unlock(&mm_lock);
+}
+
+/// @brief serve a nested allocation during initialization from the bootstrap area
+static void* bootstrap_alloc(size_t size)
+{
+  size_t start = (bootstrap_used + MIN_ALIGN - 1) & ~(size_t)(MIN_ALIGN - 1);
+  if ((size > BOOTSTRAP_SIZE) || (start > BOOTSTRAP_SIZE - size)) return NULL;
+
+  bootstrap_used = start + size;
+  return &bootstrap[start];
+}
+
+/// @brief check whether @a ptr lies in the bootstrap area
+static int is_bootstrap(void *ptr)
+{
+  return ((char*)ptr >= bootstrap) && ((char*)ptr < bootstrap + BOOTSTRAP_SIZE);
+}
+
+/// @brief acquire the lock and initialize the heap on first use
+/// @retval 1 if the caller holds the lock and may use memmgr
+/// @retval 0 if this is a nested call during initialization (use the bootstrap area)
+static int enter(void)
+{
+  if (mm_busy) return 0;
+
+  pthread_mutex_lock(&mm_lock);
+  if (!mm_ready) {
+    mm_busy = 1;
+
+    AllocationPolicy ap = ap_TLSF;
+    const char *policy = getenv("MM_POLICY");
+    if (policy != NULL) {
+      if (strcmp(policy, "firstfit") == 0) ap = ap_FirstFit;
+      else if (strcmp(policy, "nextfit") == 0) ap = ap_NextFit;
+      else if (strcmp(policy, "bestfit") == 0) ap = ap_BestFit;
+      else if (strcmp(policy, "buddy") == 0) ap = ap_Buddy;
+    }
+
+    size_t heapsize = DEFAULT_HEAPSIZE;
+    const char *hs = getenv("MM_HEAPSIZE");
+    if (hs != NULL) heapsize = strtoul(hs, NULL, 0);
+
+    const char *growth = getenv("MM_GROWTH");
+    if (growth != NULL) {
+      size_t chunk = MM_GROWTH_CHUNK, cap = MM_GROWTH_CAP;
+      unsigned int shift = MM_GROWTH_SHIFT;
+      sscanf(growth, "%zi,%u,%zi", &chunk, &shift, &cap);
+      mm_setgrowth(chunk, shift, cap);
+    }
+
+    ds_allocate(heapsize);
+    mm_init(ap);
+    pthread_atfork(lock_prepare, lock_parent, lock_child);
+
+    trace_file = getenv("MM_TRACE");
+    if ((trace_file != NULL) && (tr_start(0, 0) == 0)) atexit(trace_exit);
+
+    mm_busy = 0;
+    mm_ready = 1;
+  }
+  mm_setowner();
+
+  return 1;
+}
+
+/// @brief release the lock
+static void leave(void)
+{
+  pthread_mutex_unlock(&mm_lock);
+}
+
+/// @brief memmgr payload of a pointer returned by this library
+static void* payload_of(void *ptr)
+{
+  uintptr_t shift = ((uintptr_t*)ptr)[-1];
+  return (shift & STATUS_MASK) == SHIFT_FLAG ? ptr - (shift & ~STATUS_MASK) : ptr;
+}
+
+/// @brief allocate @a size bytes aligned to @a align (power of two >= MIN_ALIGN). Lock held.
+static void* aligned_alloc_locked(size_t align, size_t size)
+{
+  // memmgr payloads are at 8 modulo the granule (>= 16): one extra word suffices for 16-byte
+  // alignment
+  size_t extra = sizeof(uintptr_t) + (align > MIN_ALIGN ? align : 0);
+  if (size > SIZE_MAX - extra) return NULL;
+
+  void *payload = mm_malloc(size + extra);
+  if (payload == NULL) return NULL;
+
+  uintptr_t ptr = ((uintptr_t)payload + sizeof(uintptr_t) + align - 1) & ~(uintptr_t)(align - 1);
+  ((uintptr_t*)ptr)[-1] = (ptr - (uintptr_t)payload) | SHIFT_FLAG;
+  return (void*)ptr;
+}
+
+/// @brief allocate @a size bytes aligned to @a align, setting errno on failure
+static void* do_alloc(size_t align, size_t size)
+{
+  void *ptr;
+
+  if (!enter()) return bootstrap_alloc(size);
+  ptr = aligned_alloc_locked(align, size);
+  leave();
+
+  if (ptr == NULL) errno = ENOMEM;
+  return ptr;
+}
+
+/// @brief usable size of @a ptr (not in the bootstrap area). Lock held.
+static size_t usable_size_locked(void *ptr)
+{
+  void *payload = payload_of(ptr);
+  return mm_usable_size(payload) - (ptr - payload);
+}
+
+
+EXPORT void* malloc(size_t size)
+{
+  return do_alloc(MIN_ALIGN, size);
+}
+
+EXPORT void free(void *ptr)
+{
+  if ((ptr == NULL) || is_bootstrap(ptr)) return;
+
+  if (!enter()) return;
+  mm_free(payload_of(ptr));
+  leave();
+}
+
+EXPORT void* calloc(size_t nmemb, size_t size)
+{
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  void *ptr = do_alloc(MIN_ALIGN, total);
+  if (ptr != NULL) memset(ptr, 0, total);
+  return ptr;
+}
+
+EXPORT void* realloc(void *ptr, size_t size)
+{
+  if (ptr == NULL) return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  if (is_bootstrap(ptr)) {
+    // bootstrap blocks do not record their size; copy what can possibly be valid
+    void *new_ptr = malloc(size);
+    size_t avail = bootstrap + BOOTSTRAP_SIZE - (char*)ptr;
+    if (new_ptr != NULL) memcpy(new_ptr, ptr, size < avail ? size : avail);
+    return new_ptr;
+  }
+
+  if (!enter()) return NULL;
+
+  void *payload = payload_of(ptr);
+  void *new_ptr = NULL;
+  if (ptr - payload == sizeof(uintptr_t)) {
+    // default alignment: memmgr moves the shift word along with the data
+    void *new_payload = mm_realloc(payload, size + sizeof(uintptr_t));
+    if (new_payload != NULL) new_ptr = new_payload + sizeof(uintptr_t);
+  } else {
+    // over-aligned block (memalign etc.): the shift may differ, reallocate and copy
+    size_t old = usable_size_locked(ptr);
+    new_ptr = aligned_alloc_locked(MIN_ALIGN, size);
+    if (new_ptr != NULL) {
+      memcpy(new_ptr, ptr, size < old ? size : old);
+      mm_free(payload);
+    }
+  }
+  leave();
+
+  if (new_ptr == NULL) errno = ENOMEM;
+  return new_ptr;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  if ((alignment < sizeof(void*)) || ((alignment & (alignment - 1)) != 0)) return EINVAL;
+
+  void *ptr = do_alloc(alignment < MIN_ALIGN ? MIN_ALIGN : alignment, size);
+  if (ptr == NULL) return ENOMEM;
+
+  *memptr = ptr;
+  return 0;
+}
+
+EXPORT void* aligned_alloc(size_t alignment, size_t size)
+{
+  if ((alignment == 0) || ((alignment & (alignment - 1)) != 0)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return do_alloc(alignment < MIN_ALIGN ? MIN_ALIGN : alignment, size);
+}
+
+EXPORT void* memalign(size_t alignment, size_t size)
+{
+  return aligned_alloc(alignment, size);
+}
+
+EXPORT void* valloc(size_t size)
+{
+  return do_alloc(getpagesize(), size);
+}
+
+EXPORT void* pvalloc(size_t size)
+{
+  size_t pagesize = getpagesize();
+  return do_alloc(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+  if ((ptr == NULL) || is_bootstrap(ptr)) return 0;
+
+  if (!enter()) return 0;
+  size_t size = usable_size_locked(ptr);
+  leave();
+
+  return size;
+}
@@ -19,7 +19,11 @@
 //
 // Implicit free list:
 // -------------------
-// - minimal block size: 32 bytes (header +footer + 2 data words)
+// - granule (BS): 32 bytes by default, 16 or 64 selectable at build time (MM_GRANULE). Blocks
+//   start at and are multiples of the granule
+// - minimal block size (MIN_BS): 32 bytes (header + footer + 2 data words) or 64 (MM_MIN_BLOCK).
+//   With a 16-byte granule, a block may be 48 bytes, but never 16: a free block must hold the
+//   free-list links and remote frees store their link in the first payload word
 // - h,f: header/footer of free block
 // - H,F: header/footer of allocated block
 //
@@ -35,25 +39,129 @@
 //               +---+---+-----------------------------------------+---+---+
 //                       ^                                         ^
 //                       |                                         |
-//               32-byte aligned                           32-byte aligned
+//               BS-byte aligned                           BS-byte aligned
 //
 // - allocation policies: first, next, best fit
-// - block splitting: always at 32-byte boundaries
+// - next fit: the rover (nf_curr) follows coalescing. If the block it points to is merged with its
+//   free predecessor, the rover moves to the start of the merged block instead of heap_start
+// - block splitting: always at granule boundaries. A block is not split if the remainder would
+//   be smaller than MIN_BS
 // - immediate coalescing upon free
 //
+// Wilderness:
+// -----------
+// The free block at the top of the heap (the wilderness) is treated specially. mm_malloc() keeps
+// a count of the free blocks; if the wilderness is the only one, as during allocation-heavy
+// startup phases or while the heap grows monotonically, the block is carved from the bottom of
+// the wilderness without running the policy's search. The heap is extended geometrically by at
+// least 1/8 of the used heap (top_pad()), so that ds_sbrk() is called O(log n) times for n
+// allocations. Conversely, a free top block is only trimmed if it exceeds both TRIM_THRESHOLD and
+// twice the top pad, and then only down to the top pad. The fraction, an upper bound for a single
+// extension, and the minimal extension (chunk) can be changed with mm_setgrowth().
+//
+// Binary buddy allocator (ap_Buddy):
+// ----------------------------------
+// The buddy policy uses the same boundary tags so that mm_check() and the statistics can walk the
+// heap as usual, but manages it as an arena of 2^k blocks:
+// - the arena starts at heap_start and is BS << bd_order bytes large. It grows by doubling (the new
+//   upper half becomes a free block of the old top order) and shrinks by halving when its upper
+//   half is free
+// - block sizes are powers of two times BS; an order-k block at offset o has its buddy at o^(BS<<k)
+// - free blocks are kept in per-order doubly-linked lists (next/prev in the first payload words)
+// - a bitmap with one bit per possible order-k block tells whether a buddy is free at that order
+//   without touching the buddy's memory. The bitmap lives outside the data segment in an mmap'ed
+//   region sized for the largest possible arena; only the pages actually used are backed by memory
+//
+//   order-k block:      +---+------+------+-- ... --+---+
+//                       | h | next | prev |         | f |
+//                       +---+------+------+-- ... --+---+
+//
+// Two-level segregated fit (ap_TLSF):
+// -----------------------------------
+// TLSF keeps every free block of the implicit heap in one of FL x SL segregated free lists (same
+// next/prev layout as the buddy lists). The first level splits sizes into powers of two, the second
+// level splits each power of two linearly into TLSF_SL_COUNT classes; sizes below TLSF_SMALL are
+// spread linearly over first level 0. A first-level bitmap and one second-level bitmap per first
+// level record which lists are non-empty, so that a large enough block is found with two find-
+// first-set operations in constant time. Requests are rounded up to the next class ("good fit"),
+// hence every block in the found list is large enough.
+// Splitting and coalescing use the boundary tags exactly as for the other policies; the free lists
+// are kept up to date through the insert_free_block()/remove_free_block() hooks.
+// mm_reserve() pre-splits the reserved space into free blocks of the profile's classes and releases
+// them without coalescing, so that they stay in their lists. Under TLSF, adjacent free blocks may
+// therefore exist after mm_reserve(); freeing a block only coalesces it with its direct neighbors.
+//
+// Granule bitmap (mm_setbitmap()):
+// --------------------------------
+// First and next fit can optionally search a bitmap instead of the boundary tags. The bitmap holds
+// one bit per BS-byte granule of the heap; a bit is set iff its granule belongs to a free block.
+// Since free blocks are coalesced immediately, every maximal run of set bits is exactly one free
+// block, and a free block of at least k granules is the first run of >= k set bits. The search
+// skips runs of allocated granules a full word (64 granules) at a time and never touches heap
+// memory. The bitmap is kept up to date through the insert_free_block()/remove_free_block() hooks
+// and lives in an mmap'ed region outside the data segment like the buddy bitmap.
+//
+// Cross-thread frees:
+// -------------------
+// The heap is owned by the thread that called mm_init(); only the owner allocates and manipulates
+// the boundary tags. Other threads may free blocks: mm_free()/mm_free_sized() called by a foreign
+// thread push the block onto a lock-free remote-free stack (mm_remote) with a single CAS and
+// return without touching any other block. The link is stored in the first payload word; the
+// block stays marked allocated until the owner drains the stack. The owner takes the entire stack
+// with one atomic exchange on its next allocation miss (before extending the heap) and frees the
+// blocks as a batch. Since the owner never pops single elements, the stack is not subject to ABA.
+//
+// Purging free memory (mm_purge(), mm_setpurge()):
+// ------------------------------------------------
+// The heap only shrinks when its top block is free. To return the pages of free blocks in the
+// middle of the heap to the OS, the page-aligned interior of a free block (excluding the header,
+// the free-list links, and the footer) is released with madvise(MADV_DONTNEED), either on demand
+// for all free blocks above a size or automatically whenever free() produces a large enough
+// coalesced block. A bitmap with one bit per page (pg_map) records which pages have been purged
+// and still read as zero: writing a boundary tag into a purged page and freeing a block clear the
+// bits of the affected pages. mm_calloc() skips clearing purged pages. Purging is a no-op for
+// file-backed heaps, where MADV_DONTNEED neither releases the pages nor zeroes them.
+//
+// Persistent heaps:
+// -----------------
+// If the data segment is file-backed (ds_setfile()), mm_init() records heap_start, the policy, and
+// a root pointer (mm_setroot()) in the data segment's meta area. When the data segment was restored
+// from the file, mm_init() walks the heap, and if the boundary tags are consistent, reattaches to
+// it: the policy's free lists are rebuilt from the free blocks instead of re-initializing the heap.
+// Buddy heaps can only be reattached by the buddy policy and vice versa. An inconsistent heap
+// (e.g., after a crash in the middle of an operation) is discarded and initialized from scratch.
+// Since all boundary tags are relative, a heap that has been relocated can be reattached, too.
+// Pointers stored inside the heap by the application are, of course, only valid if the heap
+// was restored at the same address (ds_restored() == 1).
+//
+// Handles and compaction (mm_halloc(), mm_compact()):
+// ---------------------------------------------------
+// Blocks allocated with mm_halloc() are accessed through a handle, an index into a handle table
+// that lives outside the data segment. The handle is stored in the first payload word and both
+// tags carry the MOVABLE flag in addition to ALLOC. mm_compact() walks the heap from a cursor and
+// slides every unlocked movable block that follows a free block down into it (memmove + handle
+// table update); the free space bubbles up and is coalesced with the next free block. The work per
+// call is bounded by a budget so that the application can compact incrementally, and the cursor
+// follows coalescing like the next-fit rover. When a pass reaches the end of the heap, the free
+// top block is trimmed down to the top pad. Locked and ordinary blocks stay where they are.
+//
 
 
 #include <assert.h>
 #include <error.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "dataseg.h"
 #include "memmgr.h"
+#include "trace.h"
 
 void mm_check(void);
 
@@ -65,11 +173,29 @@ static void *heap_start    = NULL;                     ///< logical start of hea
 static void *heap_end      = NULL;                     ///< logical end of heap
 static int  PAGESIZE       = 0;                        ///< memory system page size
 static void *(*get_free_block)(size_t) = NULL;         ///< get free block for selected allocation policy
+static AllocationPolicy mm_policy;                     ///< selected allocation policy
+static void (*insert_free_block)(void*) = NULL;        ///< add free block to policy's free lists
+static void (*remove_free_block)(void*) = NULL;        ///< remove free block from policy's free lists
+static void *mm_root       = NULL;                     ///< application root pointer (mm_setroot())
 static int  mm_initialized = 0;                        ///< initialized flag (yes: 1, otherwise 0)
 static int  mm_loglevel    = 0;                        ///< log level (0: off; 1: info; 2: verbose)
 static void *nf_curr       = NULL;
+static unsigned long mm_nsearch  = 0;                  ///< number of free block searches
+static unsigned long mm_nvisited = 0;                  ///< number of blocks visited by all searches
+static unsigned long mm_nfree    = 0;                  ///< number of free blocks (not for buddy)
+static int  mm_bitmap      = 0;                        ///< use granule bitmap for first/next fit
+static pthread_t mm_owner;                             ///< thread that called mm_init()
+static void *mm_remote     = NULL;                     ///< remote-free stack (headers, NEXT_FREE)
+static unsigned long mm_nremote = 0;                   ///< number of blocks drained from mm_remote
+static size_t mm_purge_threshold = 0;                  ///< auto-purge free blocks >= size (0: off)
+static unsigned long *pg_map = NULL;                   ///< one bit per page (1: purged, reads zero)
+static size_t pg_mapsize   = 0;                        ///< size of pg_map in bytes
+static unsigned long mm_chunk = MM_GROWTH_CHUNK;       ///< minimal heap extension (mm_setgrowth())
+static unsigned int mm_growth_shift = MM_GROWTH_SHIFT; ///< extend heap by >= used heap >> shift
+static unsigned long mm_growth_cap = MM_GROWTH_CAP;    ///< maximal geometric extension (0: none)
 /// @}
 
+
 /// @name Macro definitions
 /// @{
 #define MAX(a, b)          ((a) > (b) ? (a) : (b))     ///< MAX function
@@ -79,13 +205,29 @@ static void *nf_curr       = NULL;
 
 #define ALLOC              1                           ///< block allocated flag
 #define FREE               0                           ///< block free flag
+#define MOVABLE            2                           ///< block relocatable flag (with ALLOC)
 #define STATUS_MASK        ((TYPE)(0x7))               ///< mask to retrieve flagsfrom header/footer
 #define SIZE_MASK          (~STATUS_MASK)              ///< mask to retrieve size from header/footer
 
-#define CHUNKSIZE          (1*(1 << 12))               ///< size by which heap is extended
+#define CHUNKSIZE          (1*(1 << 12))               ///< initial size of the buddy arena
+#define TRIM_THRESHOLD     (32*mm_chunk)               ///< minimal size of top block to be trimmed
 
-#define BS                 32                          ///< minimal block size. Must be a power of 2
+#define BS                 MM_GRANULE                  ///< granule (block alignment). Power of 2
 #define BS_MASK            (~(BS-1))                   ///< alignment mask
+#define MIN_BS             MM_MIN_BLOCK                ///< minimal block size
+
+#if BS == 16
+  #define BS_LOG2          4                           ///< log2(BS)
+#elif BS == 32
+  #define BS_LOG2          5
+#elif BS == 64
+  #define BS_LOG2          6
+#else
+  #error "MM_GRANULE must be 16, 32, or 64."
+#endif
+#if (MIN_BS % BS != 0) || (MIN_BS < 4*8) || (MIN_BS > 64)
+  #error "MM_MIN_BLOCK must be a multiple of MM_GRANULE between 32 and 64."
+#endif
 
 #define WORD(p)            ((TYPE)(p))                 ///< convert pointer to TYPE
 #define PTR(w)             ((void*)(w))                ///< convert TYPE to void*
@@ -100,6 +242,31 @@ static void *nf_curr       = NULL;
 #define GET_SIZE(p)        (SIZE(GET(p)))              ///< extract size from header/footer
 #define GET_STATUS(p)      (STATUS(GET(p)))            ///< extract status from header/footer
 
+#define BLOCK_SIZE(size)   MAX((((size) + 2*TYPE_SIZE - 1) / BS + 1) * BS, MIN_BS) ///< block size for payload size
+
+#define NEXT_FREE(p)       (*(void**)((p)+TYPE_SIZE))  ///< next pointer of free block in free list
+#define PREV_FREE(p)       (*(void**)((p)+2*TYPE_SIZE))///< prev pointer of free block in free list
+
+#define BD_MAX_ORDERS      48                          ///< maximal number of buddy orders
+#define BD_BITS            (8*sizeof(unsigned long))   ///< bits per buddy bitmap word
+
+#define TLSF_SL_LOG2       4                           ///< log2 of number of second-level lists
+#define TLSF_SL_COUNT      (1 << TLSF_SL_LOG2)         ///< number of second-level lists
+#define TLSF_FL_SHIFT      (TLSF_SL_LOG2 + BS_LOG2)    ///< log2(TLSF_SL_COUNT * BS)
+#define TLSF_SMALL         (1UL << TLSF_FL_SHIFT)      ///< sizes below are mapped linearly
+#define TLSF_FL_COUNT      (64 - TLSF_FL_SHIFT + 1)    ///< number of first-level lists
+#define MSB(x)             (63 - __builtin_clzl(x))    ///< index of most significant set bit
+
+#define GB_BITS            (8*sizeof(unsigned long))   ///< bits per granule bitmap word
+#define GB_NONE            ((size_t)-1)                ///< no run found
+#define GRANULE(p)         ((size_t)((p) - heap_start) / BS) ///< granule index of address p
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23                         ///< Linux >= 5.14, older kernels fail
+#endif
+
+#define PAGE(p)            ((size_t)((p) - ds_heap_start) / PAGESIZE) ///< page index of address p
+
 // TODO add more macros as needed
 
 /// @brief print a log message if level <= mm_loglevel. The variadic argument is a printf format
@@ -160,9 +327,137 @@ static void mm_panic(const char *func, ...)
 /// @}
 
 
+/// @name buddy allocator state
+/// @{
+static int  bd_order       = 0;                        ///< current arena order (size: BS << bd_order)
+static int  bd_minorder    = 0;                        ///< initial (and minimal) arena order
+static int  bd_maxorder    = 0;                        ///< largest arena order the data segment holds
+static void *bd_list[BD_MAX_ORDERS];                   ///< per-order free lists
+static unsigned long *bd_map = NULL;                   ///< per-order free bitmaps
+static size_t bd_mapsize   = 0;                        ///< size of bd_map in bytes
+static size_t bd_mapofs[BD_MAX_ORDERS];                ///< bit offset of order k in bd_map
+/// @}
+
+/// @name persistent heap state
+/// @{
+#define MM_MAGIC           "CSAPMM01"                  ///< magic number of persistent heap state
+
+/// @brief memory manager state kept in the meta area of a file-backed data segment
+typedef struct {
+  char             magic[8];                           ///< MM_MAGIC
+  AllocationPolicy policy;                             ///< policy that initialized the heap
+  size_t           heap_start;                         ///< heap_start - ds_heap_start
+  size_t           root;                               ///< root - heap_start (0: NULL)
+} MMPersist;
+
+static MMPersist *mm_persist = NULL;                   ///< persistent state (NULL: anonymous heap)
+/// @}
+
+/// @name TLSF state
+/// @{
+static void *tlsf_list[TLSF_FL_COUNT][TLSF_SL_COUNT];  ///< segregated free lists
+static unsigned long tlsf_flmap = 0;                   ///< first-level bitmap (bit f: any list in f)
+static unsigned int tlsf_slmap[TLSF_FL_COUNT];         ///< second-level bitmaps
+/// @}
+
+/// @name granule bitmap state
+/// @{
+static unsigned long *gb_map = NULL;                   ///< one bit per granule (1: free)
+static size_t gb_mapsize   = 0;                        ///< size of gb_map in bytes
+/// @}
+
+/// @name handles & compaction state
+/// @{
+/// @brief handle table entry
+typedef struct {
+  void             *ptr;                               ///< payload returned by mm_hlock()
+  unsigned long    lock;                               ///< lock count
+} HandleEntry;
+
+static HandleEntry *hd_table = NULL;                   ///< handle table (index: MMHandle)
+static size_t hd_mapsize   = 0;                        ///< size of hd_table in bytes
+static size_t hd_count     = 1;                        ///< number of entries used (0 is invalid)
+static size_t hd_unused    = 0;                        ///< first unused entry (0: none)
+static void *cp_cursor     = NULL;                     ///< compaction cursor (NULL: start a pass)
+static void *mm_reserve_end = NULL;                    ///< heap is not trimmed below (mm_reserve())
+/// @}
+
+
 static void* ff_get_free_block(size_t);
 static void* nf_get_free_block(size_t);
 static void* bf_get_free_block(size_t);
+static void  release_block(void*, unsigned long);
+static void  bd_init(void);
+static int   bd_attach(void);
+static void* bd_malloc(size_t);
+static void* bd_realloc(void*, size_t);
+static void  bd_free(void*, unsigned long);
+static unsigned long bd_block_size(size_t);
+static int   bd_order_of(unsigned long);
+static int   bd_isfree(void*, int);
+static void  bd_insert(void*, int);
+static int   bd_grow_block(void*, int);
+static void  tlsf_init(void);
+static void* tlsf_get_free_block(size_t);
+static void  tlsf_insert(void*);
+static void  tlsf_remove(void*);
+static void  gb_init(void);
+static void* gb_ff_get_free_block(size_t);
+static void* gb_nf_get_free_block(size_t);
+static void  gb_insert(void*);
+static void  gb_remove(void*);
+static void  gb_mark(size_t, size_t, int);
+static int   gb_isfree(size_t);
+static int   remote_drain(void);
+static int   pg_ispurged(size_t);
+static void  pg_clear(void*, size_t);
+static size_t pg_purge(void*);
+
+/// @brief reattach to the heap of a restored file-backed data segment. Verifies the sentinels and
+///        boundary tags of all blocks and rebuilds the free lists of the selected policy.
+/// @retval 1 if the heap is consistent and has been reattached
+/// @retval 0 otherwise (heap is left untouched)
+static int mm_attach(void)
+{
+  if ((mm_persist == NULL) || !ds_restored() ||
+      (memcmp(mm_persist->magic, MM_MAGIC, sizeof(mm_persist->magic)) != 0) ||
+      ((mm_persist->policy == ap_Buddy) != (mm_policy == ap_Buddy))) return 0;
+
+  heap_start = ds_heap_start + mm_persist->heap_start;
+  heap_end = PTR(WORD(ds_heap_brk - TYPE_SIZE) / BS * BS);
+  if ((heap_start < ds_heap_start + TYPE_SIZE) || (heap_start > heap_end) ||
+      (WORD(heap_start) % BS != 0) ||
+      (GET(PREV_PTR(heap_start)) != PACK(0, ALLOC)) || (GET(heap_end) != PACK(0, ALLOC))) return 0;
+
+  void *p = heap_start;
+  while (p < heap_end) {
+    TYPE size = GET_SIZE(p);
+    if ((size == 0) || (size % BS != 0) || (p + size > heap_end) ||
+        (GET(p) != GET(p + size - TYPE_SIZE))) return 0;
+    p += size;
+  }
+  if (p != heap_end) return 0;
+
+  LOG(1, "  reattaching to persistent heap %p - %p", heap_start, heap_end);
+
+  // rebuild free lists
+  if (mm_policy == ap_Buddy) {
+    if (!bd_attach()) return 0;
+  } else {
+    if (mm_policy == ap_TLSF) tlsf_init();
+    if (insert_free_block == gb_insert) gb_init();
+    for (p = heap_start; p < heap_end; p += GET_SIZE(p)) {
+      if (GET_STATUS(p) != FREE) continue;
+      if (insert_free_block != NULL) insert_free_block(p);
+      mm_nfree++;
+    }
+  }
+
+  mm_persist->policy = mm_policy;
+  mm_root = mm_persist->root != 0 ? heap_start + mm_persist->root : NULL;
+
+  return 1;
+}
 
 void mm_init(AllocationPolicy ap)
 {
@@ -172,12 +467,23 @@ void mm_init(AllocationPolicy ap)
   // set allocation policy
   //
   char *apstr;
+  insert_free_block = remove_free_block = NULL;
   switch (ap) {
     case ap_FirstFit: get_free_block = ff_get_free_block; apstr = "first fit"; break;
     case ap_NextFit:  get_free_block = nf_get_free_block; apstr = "next fit";  break;
     case ap_BestFit:  get_free_block = bf_get_free_block; apstr = "best fit";  break;
+    case ap_Buddy:    get_free_block = NULL;              apstr = "buddy";     break;
+    case ap_TLSF:     get_free_block = tlsf_get_free_block; apstr = "tlsf";
+                      insert_free_block = tlsf_insert;
+                      remove_free_block = tlsf_remove;                         break;
     default: PANIC("Invalid allocation policy.");
   }
+  if (mm_bitmap && ((ap == ap_FirstFit) || (ap == ap_NextFit))) {
+    get_free_block = ap == ap_FirstFit ? gb_ff_get_free_block : gb_nf_get_free_block;
+    insert_free_block = gb_insert;
+    remove_free_block = gb_remove;
+  }
+  mm_policy = ap;
   LOG(2, "  allocation policy       %s\n", apstr);
 
   //
@@ -192,16 +498,48 @@ void mm_init(AllocationPolicy ap)
          ds_heap_start, ds_heap_brk, PAGESIZE);
 
   if (ds_heap_start == NULL) PANIC("Data segment not initialized.");
-  if (ds_heap_start != ds_heap_brk) PANIC("Heap not clean.");
   if (PAGESIZE == 0) PANIC("Reported pagesize == 0.");
 
+  nf_curr = NULL;
+  mm_root = NULL;
+  mm_nsearch = mm_nvisited = 0;
+  mm_nfree = 0;
+  mm_owner = pthread_self();
+  mm_remote = NULL;
+  mm_nremote = 0;
+  if (pg_map != NULL) munmap(pg_map, pg_mapsize);
+  pg_map = NULL;
+  if (hd_table != NULL) munmap(hd_table, hd_mapsize);
+  hd_table = NULL;
+  hd_count = 1;
+  hd_unused = 0;
+  cp_cursor = NULL;
+  mm_reserve_end = NULL;
+  size_t persist_size;
+  mm_persist = ds_getmeta(&persist_size);
+  if ((mm_persist != NULL) && (persist_size < sizeof(MMPersist))) PANIC("Meta area too small.");
+
+  if (ds_heap_start != ds_heap_brk) {
+    //
+    // a restored file-backed heap is reattached if it is consistent, otherwise discarded
+    //
+    if (mm_attach()) {
+      mm_initialized = 1;
+      return;
+    }
+    if (mm_persist == NULL) PANIC("Heap not clean.");
+
+    LOG(1, "  persistent heap inconsistent, re-initializing");
+    ds_sbrk(ds_heap_start - ds_heap_brk);
+  }
+
   //
   // initialize heap
   //
   // TODO
   //
-  // allocate first chunk
-  ds_sbrk(CHUNKSIZE);
+  // allocate first chunk (fall back to the smallest chunk if the data segment is too small)
+  if (ds_sbrk(mm_chunk) == (void*)-1) ds_sbrk(CHUNKSIZE);
   ds_heap_stat(&ds_heap_start, &ds_heap_brk, NULL);
   PAGESIZE = ds_getpagesize();
   heap_start = PTR((WORD(ds_heap_start) / BS + 1) * BS);
@@ -222,6 +560,20 @@ void mm_init(AllocationPolicy ap)
   // post heap block
   GET(heap_end) = PACK(0, ALLOC);
 
+  if (mm_policy == ap_Buddy) bd_init();
+  if (mm_policy == ap_TLSF) tlsf_init();
+  if (insert_free_block == gb_insert) gb_init();
+  if (insert_free_block) insert_free_block(heap_start);
+  if (mm_policy != ap_Buddy) mm_nfree = 1;
+
+  // record heap layout for a later reattach
+  if (mm_persist != NULL) {
+    memcpy(mm_persist->magic, MM_MAGIC, sizeof(mm_persist->magic));
+    mm_persist->policy = mm_policy;
+    mm_persist->heap_start = heap_start - ds_heap_start;
+    mm_persist->root = 0;
+  }
+
 
   //
   // heap is initialized
@@ -230,12 +582,94 @@ void mm_init(AllocationPolicy ap)
 }
 
 
+/// @brief return the wilderness, i.e., the free block at the top of the heap
+/// @retval pointer to the header of the top block if it is free
+/// @retval NULL if the last block of the heap is allocated
+static void* top_block(void)
+{
+  void *footer = PREV_PTR(heap_end);
+  if (GET_STATUS(footer) != FREE) return NULL;
+  return heap_end - GET_SIZE(footer);
+}
+
+/// @brief amount of free space kept at the top of the heap: a fraction (1 >> mm_growth_shift) of
+///        the used heap, capped at mm_growth_cap and rounded up to mm_chunk. The heap is extended
+///        by at least this amount, and a free top block is only trimmed if it is considerably larger.
+/// @param used size of the heap without the wilderness
+static unsigned long top_pad(unsigned long used)
+{
+  unsigned long pad = mm_growth_shift > 0 ? used >> mm_growth_shift : 0;
+  if ((mm_growth_cap > 0) && (pad > mm_growth_cap)) pad = mm_growth_cap;
+  pad = (pad + mm_chunk - 1) / mm_chunk * mm_chunk;
+  return MAX(pad, mm_chunk);
+}
+
+/// @brief number of bytes of the free top block at @a header that are kept when the heap is
+///        trimmed: the top pad, but the heap never shrinks below the space reserved by mm_reserve()
+static unsigned long top_keep(void *header)
+{
+  unsigned long keep = top_pad(header - heap_start);
+  if (mm_reserve_end > header) keep = MAX(keep, (unsigned long)(mm_reserve_end - header));
+  return keep;
+}
+
+/// @brief extend the heap by at least @a min_size bytes and move the end sentinel. The heap grows
+///        geometrically by top_pad() bytes if that is larger, so that a growing heap calls
+///        ds_sbrk() only O(log n) times. The caller must set up the tags of the new space.
+/// @param min_size minimal number of bytes to add (multiple of BS)
+/// @retval number of bytes the heap has been extended by
+/// @retval 0 if the data segment cannot be extended
+static unsigned long heap_extend(unsigned long min_size)
+{
+  void *top = top_block();
+  void *old_end = heap_end;
+  unsigned long grow = MAX(min_size, top_pad((top != NULL ? top : heap_end) - heap_start));
+
+  if ((ds_sbrk(grow) == (void*)-1) && ((grow == min_size) || (ds_sbrk(min_size) == (void*)-1)))
+    return 0;
+
+  ds_heap_stat(NULL, &ds_heap_brk, NULL);
+  heap_end = PTR((WORD(ds_heap_brk - TYPE_SIZE) / BS) * BS); // to ensure 1 block for end sentinel
+  pg_clear(heap_end, TYPE_SIZE);
+  GET(heap_end) = PACK(0, ALLOC);
+
+  return heap_end - old_end;
+}
+
+/// @brief give the space of the free top block at @a header beyond @a keep bytes back to the data
+///        segment and move the end sentinel. The caller takes care of the free lists.
+/// @param header pointer to header of the free block at the top of the heap
+/// @param keep number of bytes to keep (multiple of BS)
+/// @retval size of the top block after shrinking
+static unsigned long heap_shrink(void *header, unsigned long keep)
+{
+  ds_sbrk(-((heap_end - header) - keep));
+  ds_heap_stat(NULL, &ds_heap_brk, NULL);
+  heap_end = PTR((WORD(ds_heap_brk - TYPE_SIZE) / BS) * BS); // to ensure 1 block for end sentinel
+
+  unsigned long size = heap_end - header;
+  void *footer = PREV_PTR(heap_end);
+  pg_clear(footer, 2*TYPE_SIZE);
+  GET(heap_end) = PACK(0, ALLOC);
+  GET(header) = PACK(size, FREE);
+  GET(footer) = PACK(size, FREE);
+
+  return size;
+}
+
 void* mm_malloc(size_t size)
 {
   LOG(1, "mm_malloc(0x%lx)", size);
 
   assert(mm_initialized);
 
+  unsigned long visited = mm_nvisited;
+  if (mm_policy == ap_Buddy) {
+    void *payload = bd_malloc(size);
+    TRACE(tr_Malloc, payload, size, mm_nvisited - visited);
+    return payload;
+  }
+
   //
   // TODO
   //
@@ -253,38 +687,70 @@ void* mm_malloc(size_t size)
   // for N, you have to traverse or store previously
   // after that, you can create the headers and footers as usual
 
-  size = (((size + 2 * TYPE_SIZE - 1) / BS) + 1) * BS; // ceiling the (size + 2 * TYPE_SIZE)
+  size_t req_size = size;
+  size = BLOCK_SIZE(size); // ceiling the (size + 2 * TYPE_SIZE)
   // LOG(2, "Block size is %lu\n", size); // LOGGING
-  void *free_p = get_free_block(size);
+  void *top = top_block();
+  void *free_p = NULL;
+  if (mm_nfree > (top != NULL)) { // there are free blocks besides the wilderness
+    mm_nsearch++;
+    free_p = get_free_block(size);
+  }
+  else if ((top != NULL) && (GET_SIZE(top) >= size)) { // only the wilderness: carve from it
+    free_p = top;
+  }
+  if ((free_p == NULL) && remote_drain()) {
+    top = top_block();
+    free_p = get_free_block(size);
+  }
   if (free_p == NULL) { // if there is no free block over size
-    // LOG(2, "Move sbrk backward\n"); // LOGGING
-    unsigned long sbrk_size = size;
-    void *last_footer = PREV_PTR(heap_end);
-    if (!GET_STATUS(last_footer)) { // last block is free
-      sbrk_size -= GET_SIZE(last_footer);
+    // extend the wilderness (or create it if the last block is allocated)
+    unsigned long top_size = top != NULL ? GET_SIZE(top) : 0;
+    void *old_end = heap_end;
+    unsigned long grown = heap_extend(size - top_size);
+    if (grown == 0) {
+      TRACE(tr_Malloc, NULL, req_size, mm_nvisited - visited);
+      return NULL;
     }
-    ds_sbrk(sbrk_size); // sbrk_size is multiple of 32
-    // update ds_heap_brk, heap_end
-    ds_heap_stat(NULL, &ds_heap_brk, NULL);
-    heap_end = PTR((WORD(ds_heap_brk - TYPE_SIZE) / BS) * BS); // to ensure 1 block for end sentinel half block
-    GET(heap_end) = PACK(0, ALLOC);
-    free_p = heap_end - size;
-    GET(free_p) = PACK(size, FREE);
-    GET(PREV_PTR(heap_end)) = PACK(size, FREE);
+    if (top == NULL) {
+      top = old_end;
+      mm_nfree++;
+    }
+    else if (remove_free_block && (remove_free_block != gb_remove)) remove_free_block(top);
+    free_p = top;
+    top_size += grown;
+    pg_clear(free_p, TYPE_SIZE);
+    pg_clear(PREV_PTR(heap_end), TYPE_SIZE);
+    GET(free_p) = PACK(top_size, FREE);
+    GET(PREV_PTR(heap_end)) = PACK(top_size, FREE);
+    if (insert_free_block == gb_insert) gb_mark(GRANULE(old_end), grown / BS, 1);
   }
+  //
+  // the granule bitmap only changes for the granules handed out below. Removing and re-inserting
+  // the whole block would cost O(block size) per carve, which adds up on a large (e.g. reserved)
+  // wilderness.
+  //
+  else if (remove_free_block && (remove_free_block != gb_remove)) remove_free_block(free_p);
   // allocate
   unsigned long origin_size = GET_SIZE(free_p);
+  if (origin_size - size < MIN_BS) size = origin_size; // remainder too small to form a block
   void *alloc_header = free_p;
   void *alloc_footer = PREV_PTR(free_p + size);
+  pg_clear(alloc_footer, TYPE_SIZE);
   GET(alloc_header) = PACK(size, ALLOC);
   GET(alloc_footer) = PACK(size, ALLOC);
   if (origin_size > size) { // if free block is bigger than wanted size
     void *free_header = free_p + size;
     void *free_footer = PREV_PTR(free_p + origin_size);
+    pg_clear(free_header, 3*TYPE_SIZE); // header and free list links
     GET(free_header) = PACK(origin_size - size, FREE);
     GET(free_footer) = PACK(origin_size - size, FREE);
+    if (insert_free_block && (insert_free_block != gb_insert)) insert_free_block(free_header);
   }
+  else mm_nfree--;
+  if (insert_free_block == gb_insert) gb_mark(GRANULE(free_p), size / BS, 0);
 
+  TRACE(tr_Malloc, free_p + TYPE_SIZE, req_size, mm_nvisited - visited);
   return free_p + TYPE_SIZE;
 }
 
@@ -298,22 +764,84 @@ void* mm_calloc(size_t nmemb, size_t size)
   // calloc is simply malloc() followed by memset()
   //
   void *payload = mm_malloc(nmemb * size);
+  if (payload == NULL) return NULL;
+
+  //
+  // purged pages still read as zero, clear only the rest. Buddy splits write tags without
+  // maintaining pg_map, so its bits are not trusted.
+  //
+  size_t len = nmemb * size;
+  if ((pg_map == NULL) || (mm_policy == ap_Buddy) || (len < (size_t)PAGESIZE)) {
+    memset(payload, 0, len);
+    TRACE(tr_Calloc, payload, len, 0);
+    return payload;
+  }
+
+  void *p = payload, *end = payload + len;
+  while (p < end) {
+    void *next = PTR((WORD(p) / PAGESIZE + 1) * PAGESIZE);
+    if (next > end) next = end;
 
-  if (payload != NULL) memset(payload, 0, nmemb * size);
+    if ((next - p < PAGESIZE) || !pg_ispurged(PAGE(p))) memset(p, 0, next - p);
+    p = next;
+  }
 
+  TRACE(tr_Calloc, payload, len, 0);
   return payload;
 }
 
-void* mm_realloc(void *ptr, size_t size)
+/// @brief grow the allocated block at @a header to @a alloc_size bytes without moving it, by
+///        absorbing the following free block and, if the block then ends at the top of the heap,
+///        by extending the heap
+/// @param header pointer to header of allocated block
+/// @param alloc_size requested block size (including header & footer tags), in bytes
+/// @retval 1 if the block holds at least @a alloc_size bytes
+/// @retval 0 if the block cannot grow in place (block is left untouched)
+static int grow_block(void *header, unsigned long alloc_size)
 {
-  LOG(1, "mm_realloc(%p, 0x%lx)", ptr, size);
+  unsigned long origin_size = GET_SIZE(header);
+  if (origin_size >= alloc_size) return 1;
 
-  assert(mm_initialized);
+  void *next_header = header + origin_size;
+  int next_free = !GET_STATUS(next_header);
+  unsigned long total_size = origin_size + (next_free ? GET_SIZE(next_header) : 0);
 
-  //
-  // TODO (optional)
-  //
+  if (total_size < alloc_size) {
+    if (header + total_size != heap_end) return 0;
+
+    // block is (or becomes) the last block: extend the heap by (at least) the missing bytes
+    unsigned long grown = heap_extend(alloc_size - total_size);
+    if (grown == 0) return 0;
+    total_size += grown;
+  }
+
+  if (next_free) {
+    if (nf_curr == next_header) // rover must not end up inside the extended block
+      nf_curr = header;
+    if (cp_cursor == next_header) cp_cursor = header;
+    if (remove_free_block) remove_free_block(next_header);
+    mm_nfree--;
+  }
 
+  if (total_size - alloc_size < MIN_BS) alloc_size = total_size; // remainder too small
+  void *footer = PREV_PTR(header + alloc_size);
+  pg_clear(footer, 4*TYPE_SIZE); // footer and header/links of the remainder
+  GET(header) = PACK(alloc_size, ALLOC);
+  GET(footer) = PACK(alloc_size, ALLOC);
+
+  if (total_size > alloc_size) { // if there is left block, free using mm_free
+    void *new_next_header = header + alloc_size;
+    GET(new_next_header) = PACK(total_size - alloc_size, ALLOC);
+    GET(PREV_PTR(header + total_size)) = PACK(total_size - alloc_size, ALLOC);
+    release_block(new_next_header, total_size - alloc_size);
+  }
+
+  return 1;
+}
+
+/// @brief re-allocate the block at @a ptr to hold @a size bytes (see mm_realloc())
+static void* realloc_block(void *ptr, size_t size)
+{
   if (ptr == NULL) {
     return mm_malloc(size);
   }
@@ -321,44 +849,30 @@ void* mm_realloc(void *ptr, size_t size)
     mm_free(ptr);
     return NULL;
   }
+  else if (mm_policy == ap_Buddy) {
+    return bd_realloc(ptr, size);
+  }
   else {
     void *origin_header = PREV_PTR(ptr);
     void *origin_footer = PREV_PTR(origin_header + GET_SIZE(origin_header));
     unsigned long origin_size = GET_SIZE(origin_header);
-    unsigned long alloc_size = (((size + 2 * TYPE_SIZE - 1) / BS) + 1) * BS; // ceiling the (size + 2 * TYPE_SIZE)
-    if (origin_size > alloc_size) { // if size smaller than origin size
+    unsigned long alloc_size = BLOCK_SIZE(size); // ceiling the (size + 2 * TYPE_SIZE)
+    if (origin_size >= alloc_size + MIN_BS) { // if size smaller than origin size
       GET(origin_header) = PACK(alloc_size, ALLOC);
       GET(PREV_PTR(origin_header + alloc_size)) = PACK(alloc_size, ALLOC);
       // free left block using mm_free
       GET(origin_header + alloc_size) = PACK(origin_size - alloc_size, ALLOC);
       GET(origin_footer) = PACK(origin_size - alloc_size, ALLOC);
-      mm_free(origin_header + alloc_size + TYPE_SIZE);
+      release_block(origin_header + alloc_size, origin_size - alloc_size);
       return ptr;
     }
-    else if (origin_size == alloc_size)
-      return ptr;
-    void *next_header = origin_header + origin_size;
-    void *next_footer = PREV_PTR(next_header + GET_SIZE(next_header));
-    unsigned long total_size = origin_size + GET_SIZE(next_header);
-    if (!GET_STATUS(next_header) && (total_size >= alloc_size)) { // if next block is free and large enough
-      // LOG(2, "realloc using extend. extend size: %lu\n", alloc_size - origin_size); // LOGGING
-      void *footer = PREV_PTR(origin_header + alloc_size);
-      GET(origin_header) = PACK(alloc_size, ALLOC);
-      GET(footer) = PACK(alloc_size, ALLOC);
-
-      if (total_size > alloc_size) { // if there is left block, free using mm_free
-        void *new_next_header = origin_header + alloc_size;
-        GET(new_next_header) = PACK(total_size - alloc_size, ALLOC);
-        GET(next_footer) = PACK(total_size - alloc_size, ALLOC);
-        mm_free(new_next_header + TYPE_SIZE);
-      }
-
+    else if (grow_block(origin_header, alloc_size)) {
       return ptr;
     }
     else {
       // realloc using mm_malloc
-      // LOG(2, "realloc using malloc. size: %lu\n", alloc_size);
       void *new_ptr = mm_malloc(size);
+      if (new_ptr == NULL) return NULL; // original block is left untouched
       memcpy(new_ptr, ptr, origin_size - 2 * TYPE_SIZE); // copy origin data
       mm_free(ptr);
       return new_ptr;
@@ -368,6 +882,135 @@ void* mm_realloc(void *ptr, size_t size)
   return NULL;
 }
 
+void* mm_realloc(void *ptr, size_t size)
+{
+  LOG(1, "mm_realloc(%p, 0x%lx)", ptr, size);
+
+  assert(mm_initialized);
+
+  void *payload = realloc_block(ptr, size);
+  TRACE(tr_Realloc, payload, size, 0);
+  return payload;
+}
+
+/// @brief mark the allocated block at @a header of @a size bytes free, coalesce it with its
+///        neighbors and give the top of the heap back to the data segment if possible. Not
+///        traced; used directly for blocks that were never handed out, such as the remainders
+///        split off by grow_block() and realloc_block(). Must only be called by the owner.
+/// @param header pointer to header of allocated block
+/// @param size size of block (including header & footer tags), in bytes
+static void release_block(void *header, unsigned long size)
+{
+  // the application may have written to the block
+  pg_clear(header, size);
+
+  if (mm_policy == ap_Buddy) {
+    bd_free(header, size);
+    return;
+  }
+
+  void *footer = header + size - TYPE_SIZE;
+  // reset status
+  GET(header) = PACK(size, FREE);
+  GET(footer) = PACK(size, FREE);
+  mm_nfree++;
+  // the granule bitmap only changes for this block; the free neighbours are already marked
+  int gb = (insert_free_block == gb_insert);
+  if (gb) gb_mark(GRANULE(header), size / BS, 1);
+  // coalescing
+  if (!GET_STATUS(header - TYPE_SIZE)) { // if previous block is free
+    header -= GET_SIZE(header - TYPE_SIZE);
+    if (remove_free_block && !gb) remove_free_block(header);
+    mm_nfree--;
+    size += GET_SIZE(header);
+    GET(header) = PACK(size, FREE);
+    GET(footer) = PACK(size, FREE);
+  }
+  if (!GET_STATUS(footer + TYPE_SIZE)) { // if post block is free
+    if (remove_free_block && !gb) remove_free_block(footer + TYPE_SIZE);
+    mm_nfree--;
+    footer += GET_SIZE(footer + TYPE_SIZE);
+    size += GET_SIZE(footer);
+    GET(header) = PACK(size, FREE);
+    GET(footer) = PACK(size, FREE);
+  }
+  if (footer + TYPE_SIZE == heap_end) { // if this block is at the end
+    // the wilderness is only trimmed when it is considerably larger than the top pad, otherwise
+    // alternating allocations and frees at the top of the heap would call ds_sbrk() every time
+    unsigned long keep = top_keep(header);
+    if (size > MAX(TRIM_THRESHOLD, 2*keep)) {
+      void *old_end = heap_end;
+      size = heap_shrink(header, keep);
+      footer = PREV_PTR(heap_end);
+      if (gb) gb_mark(GRANULE(heap_end), GRANULE(old_end) - GRANULE(heap_end), 0);
+    }
+  }
+  if (insert_free_block && !gb) insert_free_block(header);
+  if ((mm_purge_threshold > 0) && (size >= mm_purge_threshold)) pg_purge(header);
+  if (nf_curr != NULL) { // if next fit policy
+    if (nf_curr >= heap_end) // if nf_curr is over heap_end
+      nf_curr = heap_start;
+    else if (header <= nf_curr && nf_curr <= footer) // if nf_curr was absorbed, follow the merged block
+      nf_curr = header;
+  }
+  if ((cp_cursor > header) && ((cp_cursor <= footer) || (cp_cursor >= heap_end)))
+    cp_cursor = header; // compaction cursor was absorbed or trimmed away
+}
+
+/// @brief free the allocated block at @a header of @a size bytes that was returned to the
+///        application: release it (release_block()) or, on a foreign thread, queue it on the
+///        remote-free stack
+/// @param header pointer to header of allocated block
+/// @param size size of block (including header & footer tags), in bytes
+static void free_block(void *header, unsigned long size)
+{
+  if (!pthread_equal(pthread_self(), mm_owner)) {
+    // foreign thread: push onto the remote-free stack, the owner frees the block later
+    void *head = __atomic_load_n(&mm_remote, __ATOMIC_RELAXED);
+    do {
+      NEXT_FREE(header) = head;
+    } while (!__atomic_compare_exchange_n(&mm_remote, &head, header, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    TRACE(tr_RemoteFree, header + TYPE_SIZE, size, 0);
+    return;
+  }
+
+  TRACE(tr_Free, header + TYPE_SIZE, size, 0);
+  release_block(header, size);
+}
+
+/// @brief free all blocks on the remote-free stack. Must only be called by the heap's owner.
+/// @retval int number of blocks freed
+static int remote_drain(void)
+{
+  if (__atomic_load_n(&mm_remote, __ATOMIC_RELAXED) == NULL) return 0;
+
+  void *p = __atomic_exchange_n(&mm_remote, NULL, __ATOMIC_ACQUIRE);
+  int n = 0;
+  while (p != NULL) {
+    void *next = NEXT_FREE(p);
+    free_block(p, GET_SIZE(p));
+    p = next;
+    n++;
+  }
+
+  LOG(2, "  drained %d remotely freed blocks", n);
+  TRACE(tr_Drain, NULL, n, 0);
+  mm_nremote += n;
+  return n;
+}
+
+int mm_try_expand(void *ptr, size_t size)
+{
+  LOG(1, "mm_try_expand(%p, 0x%lx)", ptr, size);
+
+  assert(mm_initialized);
+
+  if (ptr == NULL) return 0;
+  if (mm_policy == ap_Buddy) return bd_grow_block(PREV_PTR(ptr), bd_order_of(BLOCK_SIZE(size)));
+  return grow_block(PREV_PTR(ptr), BLOCK_SIZE(size));
+}
+
 void mm_free(void *ptr)
 {
   LOG(1, "mm_free(%p)", ptr);
@@ -377,44 +1020,129 @@ void mm_free(void *ptr)
   //
   // TODO
   //
-  if (ptr == NULL || (WORD(ptr - TYPE_SIZE) % (4 * TYPE_SIZE)) != 0) // && ptr doesn't point the header of the block
+  if (ptr == NULL || (WORD(ptr - TYPE_SIZE) % BS) != 0) // && ptr doesn't point the header of the block
     LOG(0, "%p is Invalid Pointer!\n", ptr);
   else {
     ptr -= TYPE_SIZE;
     // then find the address of the footer for this block by reading the size
-    unsigned long size = GET_SIZE(ptr);
-    void *header = ptr;
-    void *footer = ptr + GET_SIZE(ptr) - TYPE_SIZE;
-    // reset status
-    GET(header) = PACK(GET_SIZE(header), FREE);
-    GET(footer) = PACK(GET_SIZE(footer), FREE);
-    // coalescing
-    if (!GET_STATUS(header - TYPE_SIZE)) { // if previous block is free
-      header -= GET_SIZE(header - TYPE_SIZE);
-      size += GET_SIZE(header);
-      GET(header) = PACK(size, FREE);
-      GET(footer) = PACK(size, FREE);
-    }
-    if (!GET_STATUS(footer + TYPE_SIZE)) { // if post block is free
-      footer += GET_SIZE(footer + TYPE_SIZE);
-      size += GET_SIZE(footer);
-      GET(header) = PACK(size, FREE);
-      GET(footer) = PACK(size, FREE);
-    }
-    if (footer + TYPE_SIZE == heap_end) { // if this block is at the end
-      // if the current block is the last block (end block before end sentinel block)
-      // reduce heap by calling ds_sbrk(negative_relative_size);
-      // LOG(2, "Move sbrk forward\n"); // LOGGING
-      ds_sbrk(-size);
-      ds_heap_stat(NULL, &ds_heap_brk, NULL);
-      heap_end = PTR((WORD(ds_heap_brk - TYPE_SIZE) / BS) * BS); // to ensure 1 block for end sentinel
-      GET(heap_end) = PACK(0, ALLOC);
+    free_block(ptr, GET_SIZE(ptr));
+  }
+}
+
+void mm_free_sized(void *ptr, size_t size)
+{
+  LOG(1, "mm_free_sized(%p, 0x%lx)", ptr, size);
+
+  assert(mm_initialized);
+
+  if (ptr == NULL) return;
+
+  // @a size rounds to the block size (for the usable size, BLOCK_SIZE() yields exactly the block
+  // size), so the block size follows from the same rounding mm_malloc() applies and we neither
+  // have to read nor validate the header
+  void *header = ptr - TYPE_SIZE;
+  unsigned long bsize = mm_policy == ap_Buddy ? bd_block_size(size) : BLOCK_SIZE(size);
+
+#ifdef DEBUG
+  if ((WORD(header) % BS) != 0 || GET_STATUS(header) != ALLOC || GET_SIZE(header) != bsize)
+    PANIC("%p: size 0x%lx does not match block (size 0x%lx, status %lx).",
+          ptr, size, GET_SIZE(header), GET_STATUS(header));
+#endif
+
+  free_block(header, bsize);
+}
+
+/// @brief block size mm_reserve() pre-splits for payloads of @a size bytes: the smallest block
+///        the policy hands out for the size without searching or splitting further. TLSF only
+///        looks at lists whose blocks are all large enough, so the block size is rounded up to the
+///        lower bound of the list a request for @a size maps to.
+static unsigned long reserve_block_size(size_t size)
+{
+  if (mm_policy == ap_Buddy) return bd_block_size(size);
+
+  unsigned long bsize = BLOCK_SIZE(size);
+  if ((mm_policy == ap_TLSF) && (bsize >= TLSF_SMALL)) {
+    unsigned long g = 1UL << (MSB(bsize) - TLSF_SL_LOG2);
+    bsize = (bsize + g - 1) / g * g;
+  }
+  return bsize;
+}
+
+int mm_reserve(const MMSizeClass *profile, size_t nclasses)
+{
+  LOG(1, "mm_reserve(%p, %lu)", profile, nclasses);
+
+  assert(mm_initialized);
+
+  unsigned long total = 0;
+  for (size_t i = 0; i < nclasses; i++) {
+    total += profile[i].count * reserve_block_size(profile[i].size);
+  }
+  if (total == 0) return 0;
+
+  //
+  // pre-grow the heap with a single extension that covers the whole profile and keep it from
+  // being trimmed. The buddy arena doubles while the blocks are split off below.
+  //
+  if (mm_policy != ap_Buddy) {
+    void *payload = mm_malloc(total - 2*TYPE_SIZE);
+    if (payload == NULL) return -1;
+
+    void *header = PREV_PTR(payload);
+    mm_reserve_end = MAX(mm_reserve_end, header + GET_SIZE(header));
+    mm_free(payload);
+  }
+
+  //
+  // pre-split the reserved space into free blocks of the profile's classes for the policies that
+  // find free blocks by size class. The blocks are allocated (carved from the bottom of the top
+  // block or split off the buddy arena) and then released without coalescing. Implicit-list
+  // policies keep the reservation as one top block that mm_malloc() carves without a search.
+  //
+  int res = 0;
+  if ((mm_policy == ap_TLSF) || (mm_policy == ap_Buddy)) {
+    void *list = NULL;
+    for (size_t i = 0; (i < nclasses) && (res == 0); i++) {
+      unsigned long bsize = reserve_block_size(profile[i].size);
+      for (unsigned long c = 0; c < profile[i].count; c++) {
+        void *payload = mm_malloc(mm_policy == ap_Buddy ? profile[i].size : bsize - 2*TYPE_SIZE);
+        if (payload == NULL) {
+          res = -1;
+          break;
+        }
+        *(void**)payload = list;
+        list = PREV_PTR(payload);
+      }
     }
-    if (nf_curr != NULL) { // if next fit policy
-      if (nf_curr >= heap_end || (header <= nf_curr && nf_curr <= footer)) // if nf_curr is at free block or over heap_end
-        nf_curr = heap_start;
+
+    while (list != NULL) {
+      void *header = list;
+      unsigned long size = GET_SIZE(header);
+      list = *(void**)(header + TYPE_SIZE);
+
+      if (mm_policy == ap_Buddy) {
+        bd_insert(header, bd_order_of(size));
+      } else {
+        GET(header) = PACK(size, FREE);
+        GET(PREV_PTR(header + size)) = PACK(size, FREE);
+        insert_free_block(header);
+        mm_nfree++;
+      }
     }
+
+    if (mm_policy == ap_Buddy) bd_minorder = bd_order; // never shrink below the reservation
   }
+
+  //
+  // fault in the pages of the heap now instead of on the first access to each page
+  //
+  void *start = PTR(WORD(heap_start) / PAGESIZE * PAGESIZE);
+  if (madvise(start, heap_end - start, MADV_POPULATE_WRITE) != 0) {
+    for (volatile char *c = start; (void*)c < heap_end; c += PAGESIZE) *c = *c;
+  }
+
+  LOG(2, "  reserved %lu bytes, heap %p - %p", total, heap_start, heap_end);
+  return res;
 }
 
 /// @name block allocation policites
@@ -436,6 +1164,7 @@ static void* ff_get_free_block(size_t size)
 
   void *curr = heap_start;
   while(curr < heap_end) { // until heap end
+    mm_nvisited++;
     if (!GET_STATUS(curr) && GET_SIZE(curr) >= size) {
       return curr;
     }
@@ -463,6 +1192,7 @@ static void* nf_get_free_block(size_t size)
     nf_curr = heap_start;
   void *nf_find_start = nf_curr;
   do {
+    mm_nvisited++;
     if (!GET_STATUS(nf_curr) && GET_SIZE(nf_curr) >= size) { // if there is proper free block
       // LOG(2, "nf_curr: %p\n", nf_curr);
       return nf_curr;
@@ -493,6 +1223,7 @@ static void* bf_get_free_block(size_t size)
   void *best_ptr = NULL;
   void *curr = heap_start;
   while(curr < heap_end) { // until heap_end
+    mm_nvisited++;
     if (!GET_STATUS(curr) && GET_SIZE(curr) >= size && best_size >= size) {
       // update best free block
       best_size = size;
@@ -505,66 +1236,1036 @@ static void* bf_get_free_block(size_t size)
 
 /// @}
 
-void mm_setloglevel(int level)
+/// @name binary buddy allocator
+/// @{
+
+/// @brief order of the smallest buddy block that holds @a bsize bytes
+/// @param bsize block size (including header & footer tags), in bytes
+/// @retval int order
+static int bd_order_of(unsigned long bsize)
 {
-  mm_loglevel = level;
+  int k = 0;
+  while ((BS << k) < bsize) k++;
+  return k;
 }
 
+/// @brief buddy block size for a payload of @a size bytes
+/// @param size payload size in bytes
+/// @retval unsigned long block size (including header & footer tags), in bytes
+static unsigned long bd_block_size(size_t size)
+{
+  return BS << bd_order_of(BLOCK_SIZE(size));
+}
 
-void mm_check(void)
+/// @brief bit index of the order-@a k block at @a p in bd_map
+static size_t bd_bit(void *p, int k)
 {
-  assert(mm_initialized);
+  return bd_mapofs[k] + ((WORD(p) - WORD(heap_start)) / BS >> k);
+}
 
-  void *p;
-  char *apstr;
-  if (get_free_block == ff_get_free_block) apstr = "first fit";
-  else if (get_free_block == nf_get_free_block) apstr = "next fit";
-  else if (get_free_block == bf_get_free_block) apstr = "best fit";
-  else apstr = "invalid";
+/// @brief check whether the order-@a k block at @a p is free (i.e., in bd_list[k])
+static int bd_isfree(void *p, int k)
+{
+  size_t b = bd_bit(p, k);
+  return (bd_map[b / BD_BITS] >> (b % BD_BITS)) & 1;
+}
 
-  LOG(2, "  allocation policy    %s\n", apstr);
-  printf("\n----------------------------------------- mm_check ----------------------------------------------\n");
-  printf("  ds_heap_start:          %p\n", ds_heap_start);
-  printf("  ds_heap_brk:            %p\n", ds_heap_brk);
-  printf("  heap_start:             %p\n", heap_start);
-  printf("  heap_end:               %p\n", heap_end);
-  printf("  allocation policy:      %s\n", apstr);
-  printf("  next_block:             %p\n", nf_curr);   // this will be needed for the next fit policy
+/// @brief insert block at @a p into the free list of order @a k and mark it free
+static void bd_insert(void *p, int k)
+{
+  unsigned long size = BS << k;
+  GET(p) = PACK(size, FREE);
+  GET(PREV_PTR(p + size)) = PACK(size, FREE);
 
-  printf("\n");
-  p = PREV_PTR(heap_start);
-  printf("  initial sentinel:       %p: size: %6lx (%7ld), status: %s\n",
-         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
-  p = heap_end;
-  printf("  end sentinel:           %p: size: %6lx (%7ld), status: %s\n",
-         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
-  printf("\n");
-  printf("  blocks:\n");
+  NEXT_FREE(p) = bd_list[k];
+  PREV_FREE(p) = NULL;
+  if (bd_list[k] != NULL) PREV_FREE(bd_list[k]) = p;
+  bd_list[k] = p;
 
-  long errors = 0;
-  p = heap_start;
-  while (p < heap_end) {
-    TYPE hdr = GET(p);
-    TYPE size = SIZE(hdr);
-    TYPE status = STATUS(hdr);
-    printf("    %p: size: %6lx (%7ld), status: %s\n", 
-           p, size, size, status == ALLOC ? "allocated" : "free");
+  size_t b = bd_bit(p, k);
+  bd_map[b / BD_BITS] |= 1UL << (b % BD_BITS);
+}
 
-    void *fp = p + size - TYPE_SIZE;
-    TYPE ftr = GET(fp);
-    TYPE fsize = SIZE(ftr);
-    TYPE fstatus = STATUS(ftr);
+/// @brief remove free block at @a p from the free list of order @a k
+static void bd_remove(void *p, int k)
+{
+  if (PREV_FREE(p) != NULL) NEXT_FREE(PREV_FREE(p)) = NEXT_FREE(p);
+  else bd_list[k] = NEXT_FREE(p);
+  if (NEXT_FREE(p) != NULL) PREV_FREE(NEXT_FREE(p)) = PREV_FREE(p);
 
-    if ((size != fsize) || (status != fstatus)) {
-      errors++;
-      printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
-             fp, fsize, fstatus);
-    }
+  size_t b = bd_bit(p, k);
+  bd_map[b / BD_BITS] &= ~(1UL << (b % BD_BITS));
+}
 
-    p = p + size;
-    if (size == 0) {
-      printf("    WARNING: size 0 detected, aborting traversal.\n");
-      break;
+/// @brief coalesce the order-@a k block at @a p with its free buddies and insert the result into
+///        the free lists
+static void bd_release(void *p, int k)
+{
+  while (k < bd_order) {
+    void *buddy = PTR(WORD(heap_start) + ((WORD(p) - WORD(heap_start)) ^ (BS << k)));
+    if (!bd_isfree(buddy, k)) break;
+
+    bd_remove(buddy, k);
+    if (buddy < p) p = buddy;
+    k++;
+  }
+  bd_insert(p, k);
+}
+
+/// @brief double the arena. The new upper half is released as a free block of the old top order.
+/// @retval 1 on success
+/// @retval 0 if the data segment is exhausted
+static int bd_grow(void)
+{
+  if (bd_order >= bd_maxorder) return 0;
+
+  unsigned long size = BS << bd_order;
+  if (ds_sbrk(size) == (void*)-1) return 0;
+
+  void *upper = heap_end;
+  ds_heap_stat(NULL, &ds_heap_brk, NULL);
+  heap_end = upper + size;
+  GET(heap_end) = PACK(0, ALLOC);
+  bd_order++;
+
+  bd_release(upper, bd_order - 1);
+  return 1;
+}
+
+/// @brief halve the arena as long as its upper half is free
+static void bd_shrink(void)
+{
+  while (bd_order > bd_minorder) {
+    void *upper = heap_start + (BS << (bd_order - 1));
+
+    if (bd_isfree(heap_start, bd_order)) {      // entire arena free: keep the lower half
+      bd_remove(heap_start, bd_order);
+      bd_insert(heap_start, bd_order - 1);
+    } else if (bd_isfree(upper, bd_order - 1)) {
+      bd_remove(upper, bd_order - 1);
+    } else {
+      break;
+    }
+
+    ds_sbrk(-(BS << (bd_order - 1)));
+    ds_heap_stat(NULL, &ds_heap_brk, NULL);
+    heap_end = upper;
+    GET(heap_end) = PACK(0, ALLOC);
+    bd_order--;
+  }
+}
+
+/// @brief compute the largest arena order and set up an empty bitmap and free lists
+static void bd_setup(void)
+{
+  void *ds_heap_end;
+  ds_heap_stat(NULL, NULL, &ds_heap_end);
+
+  bd_minorder = bd_order_of(CHUNKSIZE);
+  bd_maxorder = bd_order;
+  while ((bd_maxorder + 1 < BD_MAX_ORDERS) &&
+         (heap_start + (BS << (bd_maxorder + 1)) + TYPE_SIZE <= ds_heap_end)) bd_maxorder++;
+
+  // order k has 2^(bd_maxorder-k) blocks in the largest arena
+  size_t bits = 0;
+  for (int k = 0; k <= bd_maxorder; k++) {
+    bd_mapofs[k] = bits;
+    bits += 1UL << (bd_maxorder - k);
+  }
+
+  if (bd_map != NULL) munmap(bd_map, bd_mapsize);
+  bd_mapsize = (bits + BD_BITS - 1) / BD_BITS * sizeof(unsigned long);
+  bd_map = mmap(NULL, bd_mapsize, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (bd_map == MAP_FAILED) PANIC("Cannot allocate buddy bitmap.");
+
+  for (int k = 0; k < BD_MAX_ORDERS; k++) bd_list[k] = NULL;
+}
+
+/// @brief set up the buddy arena on the freshly initialized heap
+static void bd_init(void)
+{
+  // the arena must be a power of two; extend the first chunk to exactly CHUNKSIZE bytes
+  bd_order = bd_order_of(CHUNKSIZE);
+  ds_sbrk((heap_start + (BS << bd_order) + TYPE_SIZE) - ds_heap_brk);
+  ds_heap_stat(NULL, &ds_heap_brk, NULL);
+  heap_end = heap_start + (BS << bd_order);
+  GET(heap_end) = PACK(0, ALLOC);
+
+  bd_setup();
+  bd_insert(heap_start, bd_order);
+}
+
+/// @brief rebuild the buddy state of a reattached heap
+/// @retval 1 on success
+/// @retval 0 if the heap is not a valid buddy arena
+static int bd_attach(void)
+{
+  bd_order = bd_order_of(heap_end - heap_start);
+  if ((heap_start + (BS << bd_order) != heap_end) || (bd_order < bd_order_of(CHUNKSIZE))) return 0;
+
+  bd_setup();
+  for (void *p = heap_start; p < heap_end; p += GET_SIZE(p)) {
+    if (GET_STATUS(p) == FREE) bd_insert(p, bd_order_of(GET_SIZE(p)));
+  }
+  return 1;
+}
+
+/// @brief allocate a buddy block for a payload of @a size bytes
+static void* bd_malloc(size_t size)
+{
+  int k = bd_order_of(BLOCK_SIZE(size));
+  if (k > bd_maxorder) return NULL;
+
+  mm_nsearch++;
+
+  // find the smallest non-empty free list of order >= k; double the arena if there is none
+  int j = k;
+  while ((j <= bd_order) && (bd_list[j] == NULL)) {
+    mm_nvisited++;
+    j++;
+  }
+  if ((j > bd_order) && remote_drain()) {
+    j = k;
+    while ((j <= bd_order) && (bd_list[j] == NULL)) j++;
+  }
+  while (j > bd_order) {
+    if (!bd_grow()) return NULL;
+    j = k;
+    while ((j <= bd_order) && (bd_list[j] == NULL)) j++;
+  }
+  mm_nvisited++;
+
+  void *p = bd_list[j];
+  bd_remove(p, j);
+
+  // split down to order k; the upper halves go back into the free lists
+  while (j > k) {
+    j--;
+    bd_insert(p + (BS << j), j);
+  }
+
+  unsigned long bsize = BS << k;
+  GET(p) = PACK(bsize, ALLOC);
+  GET(PREV_PTR(p + bsize)) = PACK(bsize, ALLOC);
+
+  return p + TYPE_SIZE;
+}
+
+/// @brief free the allocated buddy block at @a header
+/// @param header pointer to header of allocated block
+/// @param size size of block (including header & footer tags), in bytes
+static void bd_free(void *header, unsigned long size)
+{
+  bd_release(header, bd_order_of(size));
+  bd_shrink();
+}
+
+/// @brief grow the allocated buddy block at @a header to order @a k in place. This is possible if
+///        the block is the lower half of each enclosing block up to order @a k and all the upper
+///        halves (its buddies) are free.
+/// @retval 1 if the block has order @a k or more
+/// @retval 0 if the block cannot grow in place (block is left untouched)
+static int bd_grow_block(void *header, int k)
+{
+  int j = bd_order_of(GET_SIZE(header));
+  if (j >= k) return 1;
+  if (k > bd_order) return 0;
+
+  unsigned long ofs = WORD(header) - WORD(heap_start);
+  for (int i = j; i < k; i++) {
+    if (((ofs & (BS << i)) != 0) || !bd_isfree(header + (BS << i), i)) return 0;
+  }
+
+  for (int i = j; i < k; i++) bd_remove(header + (BS << i), i);
+
+  unsigned long bsize = BS << k;
+  GET(header) = PACK(bsize, ALLOC);
+  GET(PREV_PTR(header + bsize)) = PACK(bsize, ALLOC);
+  return 1;
+}
+
+/// @brief resize the allocated buddy block containing @a ptr to hold @a size bytes
+static void* bd_realloc(void *ptr, size_t size)
+{
+  unsigned long bsize = GET_SIZE(PREV_PTR(ptr));
+  if (bd_block_size(size) == bsize) return ptr;
+  if ((bd_block_size(size) > bsize) && bd_grow_block(PREV_PTR(ptr), bd_order_of(BLOCK_SIZE(size))))
+    return ptr;
+
+  void *new_ptr = bd_malloc(size);
+  if (new_ptr != NULL) {
+    size_t old = bsize - 2*TYPE_SIZE;
+    memcpy(new_ptr, ptr, size < old ? size : old);
+    bd_free(PREV_PTR(ptr), bsize);
+  }
+  return new_ptr;
+}
+
+/// @}
+
+/// @name two-level segregated fit
+/// @{
+
+/// @brief map a block size to its first- and second-level list
+/// @param size block size (multiple of BS)
+/// @param[out] fl first-level index
+/// @param[out] sl second-level index
+static void tlsf_mapping(unsigned long size, int *fl, int *sl)
+{
+  if (size < TLSF_SMALL) {
+    *fl = 0;
+    *sl = size / BS;
+  } else {
+    int f = MSB(size);
+    *fl = f - TLSF_FL_SHIFT + 1;
+    *sl = (size >> (f - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+  }
+}
+
+/// @brief insert free block @a p into its segregated list
+static void tlsf_insert(void *p)
+{
+  int fl, sl;
+  tlsf_mapping(GET_SIZE(p), &fl, &sl);
+
+  NEXT_FREE(p) = tlsf_list[fl][sl];
+  PREV_FREE(p) = NULL;
+  if (tlsf_list[fl][sl] != NULL) PREV_FREE(tlsf_list[fl][sl]) = p;
+  tlsf_list[fl][sl] = p;
+
+  tlsf_flmap |= 1UL << fl;
+  tlsf_slmap[fl] |= 1U << sl;
+}
+
+/// @brief remove free block @a p from its segregated list
+static void tlsf_remove(void *p)
+{
+  int fl, sl;
+  tlsf_mapping(GET_SIZE(p), &fl, &sl);
+
+  if (PREV_FREE(p) != NULL) NEXT_FREE(PREV_FREE(p)) = NEXT_FREE(p);
+  else tlsf_list[fl][sl] = NEXT_FREE(p);
+  if (NEXT_FREE(p) != NULL) PREV_FREE(NEXT_FREE(p)) = PREV_FREE(p);
+
+  if (tlsf_list[fl][sl] == NULL) {
+    tlsf_slmap[fl] &= ~(1U << sl);
+    if (tlsf_slmap[fl] == 0) tlsf_flmap &= ~(1UL << fl);
+  }
+}
+
+/// @brief reset the segregated lists
+static void tlsf_init(void)
+{
+  memset(tlsf_list, 0, sizeof(tlsf_list));
+  memset(tlsf_slmap, 0, sizeof(tlsf_slmap));
+  tlsf_flmap = 0;
+}
+
+/// @brief find and return a free block of at least @a size bytes (TLSF)
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* tlsf_get_free_block(size_t size)
+{
+  LOG(1, "tlsf_get_free_block(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  // round up to the next list boundary so that any block in the found list fits
+  if (size >= TLSF_SMALL) size += (1UL << (MSB(size) - TLSF_SL_LOG2)) - 1;
+
+  int fl, sl;
+  tlsf_mapping(size, &fl, &sl);
+  if (fl >= TLSF_FL_COUNT) return NULL;
+
+  mm_nvisited++;
+
+  unsigned int slmap = tlsf_slmap[fl] & (~0U << sl);
+  if (slmap == 0) {
+    unsigned long flmap = fl + 1 < TLSF_FL_COUNT ? tlsf_flmap & (~0UL << (fl + 1)) : 0;
+    if (flmap == 0) return NULL;
+
+    fl = __builtin_ctzl(flmap);
+    slmap = tlsf_slmap[fl];
+  }
+  sl = __builtin_ctz(slmap);
+
+  return tlsf_list[fl][sl];
+}
+
+/// @}
+
+/// @name granule bitmap
+/// @{
+
+/// @brief set (@a free = 1) or clear (@a free = 0) the bits of the @a n granules starting at @a g
+static void gb_mark(size_t g, size_t n, int free)
+{
+  while (n > 0) {
+    size_t w = g / GB_BITS, b = g % GB_BITS;
+    size_t len = GB_BITS - b < n ? GB_BITS - b : n;
+    unsigned long mask = (len == GB_BITS ? ~0UL : ((1UL << len) - 1)) << b;
+
+    if (free) gb_map[w] |= mask;
+    else gb_map[w] &= ~mask;
+
+    g += len;
+    n -= len;
+  }
+}
+
+/// @brief check whether granule @a g is part of a free block
+static int gb_isfree(size_t g)
+{
+  return (gb_map[g / GB_BITS] >> (g % GB_BITS)) & 1;
+}
+
+/// @brief mark free block @a p free in the bitmap
+static void gb_insert(void *p)
+{
+  gb_mark(GRANULE(p), GET_SIZE(p) / BS, 1);
+}
+
+/// @brief mark free block @a p allocated in the bitmap
+static void gb_remove(void *p)
+{
+  gb_mark(GRANULE(p), GET_SIZE(p) / BS, 0);
+}
+
+/// @brief set up an empty bitmap covering the largest possible heap
+static void gb_init(void)
+{
+  void *ds_heap_end;
+  ds_heap_stat(NULL, NULL, &ds_heap_end);
+
+  // one extra bit for the end sentinel so that every run of set bits is terminated by a clear bit
+  size_t bits = GRANULE(ds_heap_end) + 1;
+
+  if (gb_map != NULL) munmap(gb_map, gb_mapsize);
+  gb_mapsize = (bits + GB_BITS - 1) / GB_BITS * sizeof(unsigned long);
+  gb_map = mmap(NULL, gb_mapsize, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (gb_map == MAP_FAILED) PANIC("Cannot allocate granule bitmap.");
+}
+
+/// @brief find the first run of at least @a k free granules that starts in [@a from, @a to). The
+///        run may extend beyond @a to. Every bitmap word inspected counts as a visited block.
+/// @retval size_t index of the first granule of the run (= header of a free block)
+/// @retval GB_NONE if there is no such run
+static size_t gb_find(size_t from, size_t to, size_t k)
+{
+  size_t pos = from;
+
+  while (pos < to) {
+    // skip allocated granules
+    size_t w = pos / GB_BITS;
+    unsigned long m = gb_map[w] & (~0UL << (pos % GB_BITS));
+    mm_nvisited++;
+    while (m == 0) {
+      if (++w * GB_BITS >= to) return GB_NONE;
+      m = gb_map[w];
+      mm_nvisited++;
+    }
+    size_t start = w * GB_BITS + __builtin_ctzl(m);
+    if (start >= to) return GB_NONE;
+
+    // find the end of the run; the end sentinel's granule is never free
+    m = ~gb_map[w] & (~0UL << (start % GB_BITS));
+    while (m == 0) {
+      m = ~gb_map[++w];
+      mm_nvisited++;
+    }
+    pos = w * GB_BITS + __builtin_ctzl(m);
+
+    if (pos - start >= k) return start;
+  }
+
+  return GB_NONE;
+}
+
+/// @brief find and return a free block of at least @a size bytes (first fit, granule bitmap)
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* gb_ff_get_free_block(size_t size)
+{
+  LOG(1, "gb_ff_get_free_block(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  size_t g = gb_find(0, GRANULE(heap_end), size / BS);
+  return g != GB_NONE ? heap_start + g * BS : NULL;
+}
+
+/// @brief find and return a free block of at least @a size bytes (next fit, granule bitmap)
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* gb_nf_get_free_block(size_t size)
+{
+  LOG(1, "gb_nf_get_free_block(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  if (nf_curr == NULL || nf_curr >= heap_end) nf_curr = heap_start;
+
+  // search from the rover to the end of the heap, then wrap around
+  size_t rover = GRANULE(nf_curr);
+  size_t g = gb_find(rover, GRANULE(heap_end), size / BS);
+  if (g == GB_NONE) g = gb_find(0, rover, size / BS);
+  if (g == GB_NONE) return NULL;
+
+  nf_curr = heap_start + g * BS;
+  return nf_curr;
+}
+
+/// @}
+
+/// @name purging of free memory
+/// @{
+
+#define PG_BITS            (8*sizeof(unsigned long))   ///< bits per page bitmap word
+
+/// @brief check whether page @a g has been purged
+static int pg_ispurged(size_t g)
+{
+  return (pg_map[g / PG_BITS] >> (g % PG_BITS)) & 1;
+}
+
+/// @brief mark the pages overlapping [@a p, @a p + @a len) as not purged because they are about
+///        to be written to
+static void pg_clear(void *p, size_t len)
+{
+  if ((pg_map == NULL) || (len == 0)) return;
+
+  for (size_t g = PAGE(p); g <= PAGE(p + len - 1); g++) {
+    pg_map[g / PG_BITS] &= ~(1UL << (g % PG_BITS));
+  }
+}
+
+/// @brief release the page-aligned interior of the free block at @a header to the OS
+/// @retval size_t number of bytes newly purged
+static size_t pg_purge(void *header)
+{
+  if (mm_persist != NULL) return 0;
+
+  if (pg_map == NULL) {
+    void *ds_heap_end;
+    ds_heap_stat(NULL, NULL, &ds_heap_end);
+
+    pg_mapsize = (PAGE(ds_heap_end) + PG_BITS) / PG_BITS * sizeof(unsigned long);
+    pg_map = mmap(NULL, pg_mapsize, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (pg_map == MAP_FAILED) PANIC("Cannot allocate page bitmap.");
+  }
+
+  // keep the header, the free list links, and the footer
+  void *start = PTR((WORD(header + 3*TYPE_SIZE) + PAGESIZE - 1) / PAGESIZE * PAGESIZE);
+  void *end = PTR(WORD(header + GET_SIZE(header) - TYPE_SIZE) / PAGESIZE * PAGESIZE);
+  size_t purged = 0;
+
+  // madvise() runs of pages that have not been purged yet
+  void *p = start;
+  while (p < end) {
+    while ((p < end) && pg_ispurged(PAGE(p))) p += PAGESIZE;
+    void *q = p;
+    while ((q < end) && !pg_ispurged(PAGE(q))) {
+      pg_map[PAGE(q) / PG_BITS] |= 1UL << (PAGE(q) % PG_BITS);
+      q += PAGESIZE;
+    }
+    if (q > p) {
+      if (madvise(p, q - p, MADV_DONTNEED) != 0) PANIC("madvise failed.");
+      purged += q - p;
+    }
+    p = q;
+  }
+
+  if (purged > 0) TRACE(tr_Purge, header, purged, 0);
+  return purged;
+}
+
+/// @}
+
+size_t mm_purge(size_t min_size)
+{
+  LOG(1, "mm_purge(0x%lx)", min_size);
+
+  assert(mm_initialized);
+
+  remote_drain();
+
+  size_t purged = 0;
+  for (void *p = heap_start; p < heap_end; p += GET_SIZE(p)) {
+    if ((GET_STATUS(p) == FREE) && (GET_SIZE(p) >= min_size)) purged += pg_purge(p);
+  }
+
+  return purged;
+}
+
+
+void mm_setpurge(size_t threshold)
+{
+  mm_purge_threshold = threshold;
+}
+
+
+void mm_setgrowth(size_t chunk, unsigned int shift, size_t cap)
+{
+  mm_chunk = chunk > 0 ? (chunk + BS - 1) / BS * BS : MM_GROWTH_CHUNK;
+  mm_growth_shift = shift < 8*sizeof(unsigned long) ? shift : 0;
+  mm_growth_cap = cap;
+}
+
+
+size_t mm_purged(void)
+{
+  assert(mm_initialized);
+
+  // bits of allocated blocks are only cleared when the block is freed; count free blocks only
+  size_t pages = 0;
+  if (pg_map != NULL) {
+    for (void *p = heap_start; p < heap_end; p += GET_SIZE(p)) {
+      if (GET_STATUS(p) != FREE) continue;
+      for (size_t g = PAGE(p); g <= PAGE(p + GET_SIZE(p) - 1); g++) pages += pg_ispurged(g);
+    }
+  }
+
+  return pages * PAGESIZE;
+}
+
+
+/// @name handles & compaction
+/// @{
+
+/// @brief look up handle @a h
+/// @retval HandleEntry* table entry of a live handle
+/// @retval NULL if @a h is not a live handle
+static HandleEntry* hd_entry(MMHandle h)
+{
+  if ((h == 0) || (h >= hd_count) || (hd_table[h].ptr == NULL)) return NULL;
+  return &hd_table[h];
+}
+
+/// @brief check whether the block at @a header may be moved, i.e., it is relocatable, not locked,
+///        and its handle refers back to it. Relocatable blocks of a reattached heap have no handle
+///        and stay in place.
+static int hd_movable(void *header)
+{
+  if ((GET_STATUS(header) & MOVABLE) == 0) return 0;
+
+  MMHandle h = GET(header + TYPE_SIZE);
+  HandleEntry *e = hd_entry(h);
+  return (e != NULL) && (e->ptr == header + 2*TYPE_SIZE) && (e->lock == 0);
+}
+
+/// @brief slide the relocatable block following the free block at @a header down into it. The free
+///        space moves up and is coalesced with the next block if that is free.
+/// @param header pointer to header of a free block followed by a movable block
+/// @retval pointer to header of the free block behind the moved block
+static void* cp_slide(void *header)
+{
+  unsigned long fsize = GET_SIZE(header);
+  void *block = header + fsize;
+  unsigned long bsize = GET_SIZE(block);
+
+  if (remove_free_block) remove_free_block(header);
+
+  pg_clear(header, bsize);
+  pg_clear(block, bsize);
+  memmove(header, block, bsize);
+  hd_table[GET(header + TYPE_SIZE)].ptr = header + 2*TYPE_SIZE;
+
+  void *free_header = header + bsize;
+  void *next = block + bsize;
+  if (!GET_STATUS(next)) { // if post block is free
+    if (remove_free_block) remove_free_block(next);
+    mm_nfree--;
+    fsize += GET_SIZE(next);
+  }
+  pg_clear(free_header, 3*TYPE_SIZE); // header and free list links may land in a purged page
+  GET(free_header) = PACK(fsize, FREE);
+  GET(PREV_PTR(free_header + fsize)) = PACK(fsize, FREE);
+  if (insert_free_block) insert_free_block(free_header);
+
+  // the rover must not point into the middle of the moved block
+  if ((nf_curr > header) && (nf_curr < free_header + fsize)) nf_curr = free_header;
+
+  return free_header;
+}
+
+/// @}
+
+MMHandle mm_halloc(size_t size)
+{
+  LOG(1, "mm_halloc(0x%lx)", size);
+
+  assert(mm_initialized);
+
+  if (hd_table == NULL) {
+    // one entry per granule of the data segment is enough for any number of live blocks
+    void *ds_heap_end;
+    ds_heap_stat(NULL, NULL, &ds_heap_end);
+
+    hd_mapsize = ((ds_heap_end - ds_heap_start) / BS + 1) * sizeof(HandleEntry);
+    hd_table = mmap(NULL, hd_mapsize, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (hd_table == MAP_FAILED) PANIC("Cannot allocate handle table.");
+  }
+
+  // the handle is stored in the first payload word so that the compactor can find it
+  void *payload = mm_malloc(size + TYPE_SIZE);
+  if (payload == NULL) return 0;
+
+  MMHandle h;
+  if (hd_unused != 0) {
+    h = hd_unused;
+    hd_unused = hd_table[h].lock;
+  } else {
+    h = hd_count++;
+  }
+  hd_table[h].ptr = payload + TYPE_SIZE;
+  hd_table[h].lock = 0;
+  GET(payload) = h;
+
+  if (mm_policy != ap_Buddy) {
+    void *header = PREV_PTR(payload);
+    GET(header) |= MOVABLE;
+    GET(PREV_PTR(header + GET_SIZE(header))) |= MOVABLE;
+  }
+
+  return h;
+}
+
+
+void* mm_hlock(MMHandle h)
+{
+  HandleEntry *e = hd_entry(h);
+  if (e == NULL) {
+    LOG(0, "%lu is an invalid handle!\n", h);
+    return NULL;
+  }
+
+  e->lock++;
+  return e->ptr;
+}
+
+
+void mm_hunlock(MMHandle h)
+{
+  HandleEntry *e = hd_entry(h);
+  if ((e == NULL) || (e->lock == 0)) {
+    LOG(0, "%lu is an invalid or unlocked handle!\n", h);
+    return;
+  }
+
+  e->lock--;
+}
+
+
+void mm_hfree(MMHandle h)
+{
+  LOG(1, "mm_hfree(%lu)", h);
+
+  assert(mm_initialized);
+
+  if (h == 0) return;
+
+  HandleEntry *e = hd_entry(h);
+  if ((e == NULL) || (e->lock > 0)) {
+    LOG(0, "%lu is an invalid or locked handle!\n", h);
+    return;
+  }
+
+  void *header = e->ptr - 2*TYPE_SIZE;
+  free_block(header, GET_SIZE(header));
+
+  e->ptr = NULL;
+  e->lock = hd_unused;
+  hd_unused = h;
+}
+
+
+int mm_compact(size_t budget, MMCompactStat *stat)
+{
+  LOG(1, "mm_compact(0x%lx)", budget);
+
+  assert(mm_initialized);
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  MMCompactStat st = { 0 };
+  void *brk = ds_heap_brk;
+  int done = 1;
+
+  if (mm_policy != ap_Buddy) {
+    remote_drain();
+
+    //
+    // walk the heap from the cursor. Free blocks are normally coalesced, so a free block is followed
+    // by an allocated block; if that one can be moved, the free space bubbles up past it. Adjacent
+    // free blocks pre-split by mm_reserve() are skipped like blocks that cannot be moved.
+    //
+    void *p = cp_cursor != NULL ? cp_cursor : heap_start;
+    size_t work = 0;
+    while ((p < heap_end) && ((budget == 0) || (work < budget))) {
+      work += BS;
+      if (GET_STATUS(p) == FREE) {
+        void *next = p + GET_SIZE(p);
+        if ((next < heap_end) && hd_movable(next)) {
+          st.nmoved++;
+          st.moved += GET_SIZE(next);
+          work += GET_SIZE(next);
+          p = cp_slide(p);
+          continue;
+        }
+      }
+      p += GET_SIZE(p);
+    }
+
+    if (p < heap_end) {
+      cp_cursor = p;
+      done = 0;
+    } else {
+      // pass complete: give the free top block back down to the top pad
+      cp_cursor = NULL;
+      void *top = top_block();
+      if (top != NULL) {
+        unsigned long keep = top_keep(top);
+        if (GET_SIZE(top) >= keep + mm_chunk) {
+          if (remove_free_block) remove_free_block(top);
+          heap_shrink(top, keep);
+          if (insert_free_block) insert_free_block(top);
+          if (nf_curr >= heap_end) nf_curr = heap_start;
+        }
+      }
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  st.recovered = brk - ds_heap_brk;
+  st.pause = (t1.tv_sec - t0.tv_sec)*1000000000UL + t1.tv_nsec - t0.tv_nsec;
+  LOG(2, "  moved %lu blocks (%lu bytes), recovered %lu bytes in %lu ns",
+      st.nmoved, st.moved, st.recovered, st.pause);
+  if (stat != NULL) *stat = st;
+
+  return done;
+}
+
+
+void mm_setloglevel(int level)
+{
+  mm_loglevel = level;
+}
+
+
+size_t mm_usable_size(void *ptr)
+{
+  assert(mm_initialized);
+
+  if (ptr == NULL) return 0;
+  return GET_SIZE(PREV_PTR(ptr)) - 2*TYPE_SIZE;
+}
+
+
+void mm_setowner(void)
+{
+  assert(mm_initialized);
+
+  mm_owner = pthread_self();
+}
+
+
+void mm_setbitmap(int enable)
+{
+  mm_bitmap = enable;
+}
+
+
+void mm_setroot(void *ptr)
+{
+  assert(mm_initialized);
+
+  mm_root = ptr;
+  if (mm_persist != NULL) mm_persist->root = ptr != NULL ? ptr - heap_start : 0;
+}
+
+
+void* mm_getroot(void)
+{
+  return mm_root;
+}
+
+
+int mm_snapshot(int fd)
+{
+  assert(mm_initialized);
+
+  MMSnapshotHeader hdr = { .heap_start = WORD(heap_start), .heap_end = WORD(heap_end),
+                           .policy = mm_policy };
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  memcpy(hdr.magic, MM_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.timestamp = ts.tv_sec*1000000000ULL + ts.tv_nsec;
+
+  for (void *p = heap_start; p < heap_end; p += GET_SIZE(p)) hdr.nblocks++;
+
+  if (tr_write(fd, &hdr, sizeof(hdr)) < 0) return -1;
+
+  TYPE buf[1024];
+  size_t n = 0;
+  for (void *p = heap_start; p < heap_end; p += GET_SIZE(p)) {
+    buf[n++] = GET(p);
+    if (n == sizeof(buf)/sizeof(buf[0])) {
+      if (tr_write(fd, buf, sizeof(buf)) < 0) return -1;
+      n = 0;
+    }
+  }
+  return tr_write(fd, buf, n*sizeof(buf[0]));
+}
+
+
+void mm_search_stat(unsigned long *searches, unsigned long *visited)
+{
+  if (searches) *searches = mm_nsearch;
+  if (visited)  *visited  = mm_nvisited;
+}
+
+
+void mm_check(void)
+{
+  assert(mm_initialized);
+
+  void *p;
+  char *apstr;
+  if (get_free_block == ff_get_free_block) apstr = "first fit";
+  else if (get_free_block == nf_get_free_block) apstr = "next fit";
+  else if (get_free_block == bf_get_free_block) apstr = "best fit";
+  else if (get_free_block == tlsf_get_free_block) apstr = "tlsf";
+  else if (get_free_block == gb_ff_get_free_block) apstr = "first fit (granule bitmap)";
+  else if (get_free_block == gb_nf_get_free_block) apstr = "next fit (granule bitmap)";
+  else if (mm_policy == ap_Buddy) apstr = "buddy";
+  else apstr = "invalid";
+
+  LOG(2, "  allocation policy    %s\n", apstr);
+  printf("\n----------------------------------------- mm_check ----------------------------------------------\n");
+  printf("  ds_heap_start:          %p\n", ds_heap_start);
+  printf("  ds_heap_brk:            %p\n", ds_heap_brk);
+  printf("  heap_start:             %p\n", heap_start);
+  printf("  heap_end:               %p\n", heap_end);
+  printf("  allocation policy:      %s\n", apstr);
+  printf("  granule / min. block:   %d / %d bytes\n", BS, MIN_BS);
+  printf("  reserved up to:         %p\n", mm_reserve_end);
+  printf("  growth:                 chunk %lu, used heap >> %u, cap %lu bytes\n", mm_chunk,
+         mm_growth_shift, mm_growth_cap);
+  printf("  next_block:             %p\n", nf_curr);   // this will be needed for the next fit policy
+  printf("  remote frees:           %lu drained, %s pending\n", mm_nremote,
+         __atomic_load_n(&mm_remote, __ATOMIC_RELAXED) != NULL ? "some" : "none");
+  printf("  purged:                 %lu bytes\n", mm_purged());
+  if (mm_policy == ap_Buddy)
+    printf("  buddy arena order:      %d (min %d, max %d)\n", bd_order, bd_minorder, bd_maxorder);
+
+  printf("\n");
+  p = PREV_PTR(heap_start);
+  printf("  initial sentinel:       %p: size: %6lx (%7ld), status: %s\n",
+         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
+  p = heap_end;
+  printf("  end sentinel:           %p: size: %6lx (%7ld), status: %s\n",
+         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
+  printf("\n");
+  printf("  blocks:\n");
+
+  long errors = 0;
+  long nfree = 0;
+  p = heap_start;
+  while (p < heap_end) {
+    TYPE hdr = GET(p);
+    TYPE size = SIZE(hdr);
+    TYPE status = STATUS(hdr);
+    printf("    %p: size: %6lx (%7ld), status: %s\n", 
+           p, size, size, status & MOVABLE ? "allocated (movable)" :
+                          status & ALLOC ? "allocated" : "free");
+
+    void *fp = p + size - TYPE_SIZE;
+    TYPE ftr = GET(fp);
+    TYPE fsize = SIZE(ftr);
+    TYPE fstatus = STATUS(ftr);
+
+    if ((size != fsize) || (status != fstatus)) {
+      errors++;
+      printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
+             fp, fsize, fstatus);
+    }
+
+    if ((WORD(p) % BS != 0) || (size % BS != 0) || (size < MIN_BS)) {
+      errors++;
+      printf("    --> ERROR: block not aligned to granule (%d) or smaller than minimum (%d)\n",
+             BS, MIN_BS);
+    }
+
+    if (status == FREE) nfree++;
+
+    if (mm_policy == ap_Buddy) {
+      int k = bd_order_of(size);
+      if ((size != (BS << k)) || ((WORD(p) - WORD(heap_start)) % size != 0)) {
+        errors++;
+        printf("    --> ERROR: not a buddy block of order %d\n", k);
+      } else if (bd_isfree(p, k) != (status == FREE)) {
+        errors++;
+        printf("    --> ERROR: buddy bitmap marks block as %s\n",
+               bd_isfree(p, k) ? "free" : "allocated");
+      }
+    }
+
+    if (insert_free_block == gb_insert) {
+      for (size_t g = GRANULE(p); g < GRANULE(p + size); g++) {
+        if (gb_isfree(g) != (status == FREE)) {
+          errors++;
+          printf("    --> ERROR: granule bitmap marks granule %lu as %s\n",
+                 g, gb_isfree(g) ? "free" : "allocated");
+          break;
+        }
+      }
+    }
+
+    p = p + size;
+    if (size == 0) {
+      printf("    WARNING: size 0 detected, aborting traversal.\n");
+      break;
+    }
+  }
+
+  if ((mm_policy != ap_Buddy) && ((long)mm_nfree != nfree)) {
+    errors++;
+    printf("    --> ERROR: %ld free blocks in heap, but free block count is %lu\n", nfree, mm_nfree);
+  }
+
+  if (mm_policy == ap_TLSF) {
+    // every list must be non-empty iff its bitmap bits are set and hold only free blocks of its class
+    long nlisted = 0;
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++) {
+      for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+        int mapped = ((tlsf_flmap >> fl) & 1) && ((tlsf_slmap[fl] >> sl) & 1);
+        if (mapped != (tlsf_list[fl][sl] != NULL)) {
+          errors++;
+          printf("    --> ERROR: TLSF bitmap and list [%d][%d] disagree\n", fl, sl);
+        }
+        for (void *f = tlsf_list[fl][sl]; f != NULL; f = NEXT_FREE(f)) {
+          int ffl, fsl;
+          tlsf_mapping(GET_SIZE(f), &ffl, &fsl);
+          if ((GET_STATUS(f) != FREE) || (ffl != fl) || (fsl != sl)) {
+            errors++;
+            printf("    --> ERROR: block %p in TLSF list [%d][%d] is not a free block of its class\n",
+                   f, fl, sl);
+          }
+          nlisted++;
+        }
+      }
+    }
+    if (nlisted != nfree) {
+      errors++;
+      printf("    --> ERROR: %ld free blocks in heap, but %ld in TLSF lists\n", nfree, nlisted);
     }
   }
 
@@ -35,15 +35,66 @@
 #define __MEMMGR_H__
 
 #include <stddef.h>
+#include <stdint.h>
+
+/// @brief allocation granularity in bytes: blocks start at and are multiples of MM_GRANULE bytes.
+///        Selected at build time (make GRANULE=16|32|64), default 32
+#ifndef MM_GRANULE
+#define MM_GRANULE 32
+#endif
+
+/// @brief minimal block size in bytes (multiple of MM_GRANULE, >= 32 so that a free block holds
+///        its header, two free-list links, and its footer). Selected at build time
+///        (make MINBLOCK=32|64), default max(32, MM_GRANULE)
+#ifndef MM_MIN_BLOCK
+#define MM_MIN_BLOCK (MM_GRANULE > 32 ? MM_GRANULE : 32)
+#endif
+
+/// @brief default heap growth (see mm_setgrowth()): minimal extension in bytes
+#ifndef MM_GROWTH_CHUNK
+#define MM_GROWTH_CHUNK 4096
+#endif
+
+/// @brief default heap growth: extend by at least the used heap >> MM_GROWTH_SHIFT (1/8)
+#ifndef MM_GROWTH_SHIFT
+#define MM_GROWTH_SHIFT 3
+#endif
+
+/// @brief default heap growth: upper bound of a geometric extension in bytes
+#ifndef MM_GROWTH_CAP
+#define MM_GROWTH_CAP (64UL << 20)
+#endif
 
 /// @brief supported allocation policies
 typedef enum {
   ap_FirstFit,                    ///< first fit allocation policy
   ap_NextFit,                     ///< next fit allocation policy
   ap_BestFit,                     ///< best fit allocation policy
+  ap_Buddy,                       ///< binary buddy allocator (power-of-two blocks)
+  ap_TLSF,                        ///< two-level segregated fit (constant-time search)
 } AllocationPolicy;
 
+/// @brief magic number of a heap snapshot
+#define MM_SNAPSHOT_MAGIC "CSAPSNP1"
+
+/// @brief header of a heap snapshot written by mm_snapshot(). The header is followed by @a nblocks
+///        64-bit block tags (size | status) in address order. The address of a block is heap_start
+///        plus the sum of the sizes of all preceding blocks.
+typedef struct {
+  char     magic[8];              ///< MM_SNAPSHOT_MAGIC
+  uint64_t heap_start;            ///< address of the first block
+  uint64_t heap_end;              ///< address of the end sentinel
+  uint64_t nblocks;               ///< number of block tags following the header
+  uint64_t timestamp;             ///< CLOCK_REALTIME in nanoseconds
+  uint32_t policy;                ///< AllocationPolicy
+  uint32_t reserved;              ///< unused, 0
+} MMSnapshotHeader;
+
 /// @brief initialize heap. Must be called before any of the other functions can be used.
+///        The calling thread becomes the owner of the heap; all functions except mm_free() and
+///        mm_free_sized() must only be called by the owner.
+///        If the data segment is file-backed and has been restored (see ds_setfile()), mm_init()
+///        reattaches to the existing heap if it is consistent instead of re-initializing it.
 void mm_init(AllocationPolicy ap);
 
 /// @brief allocate a block of memory of @a size bytes
@@ -66,14 +117,167 @@ void* mm_calloc(size_t nelem, size_t size);
 /// @retval NULL if memory allocation failed
 void* mm_realloc(void *ptr, size_t size);
 
-/// @brief free a previously allocated block of memory
+/// @brief free a previously allocated block of memory. May be called by any thread; blocks freed
+///        by threads other than the heap's owner are queued without locking and reclaimed by the
+///        owner on its next allocation that finds no free block.
 /// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
 void mm_free(void *ptr);
 
+/// @brief free a previously allocated block of memory whose usable size is known to the caller.
+///        Skips reading and validating the block header; @a size is only cross-checked against
+///        the header in DEBUG builds. May be called by any thread (see mm_free()).
+/// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
+/// @param size usable size of the block (mm_usable_size() after the last mm_realloc() or
+///        mm_try_expand()). The size requested from mm_malloc(), mm_calloc(), or mm_realloc()
+///        rounds to the same block only if MM_MIN_BLOCK == MM_GRANULE (blocks never absorb a
+///        remainder) and the block has not been grown by mm_try_expand()
+void mm_free_sized(void *ptr, size_t size);
+
+/// @brief retrieve the payload capacity of an allocated block. Because block sizes are rounded up,
+///        the capacity may exceed the size that was requested.
+/// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
+/// @retval size_t number of usable bytes at @a ptr
+/// @retval 0 if @a ptr is NULL
+size_t mm_usable_size(void *ptr);
+
+/// @brief grow an allocated block in place so that it holds at least @a size bytes. Never moves
+///        the block; if it cannot grow without moving, it is left untouched. Use mm_usable_size()
+///        to find out how much slack the block already has, and to obtain the size to pass to
+///        mm_free_sized() afterwards.
+/// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
+/// @param size requested payload size in bytes
+/// @retval 1 if the block at @a ptr now holds at least @a size bytes
+/// @retval 0 if the block cannot grow in place (or @a ptr is NULL)
+int mm_try_expand(void *ptr, size_t size);
+
+/// @brief make the calling thread the owner of the heap (see mm_init()). Allows several threads
+///        to use all functions if the caller serializes them, e.g., with a lock, and calls
+///        mm_setowner() whenever it acquires the lock.
+void mm_setowner(void);
+
+/// @brief set the application's root pointer. In a file-backed heap, the root survives restarts
+///        and is the entry point to the application's data after reattaching.
+/// @param ptr pointer into the heap (typically a payload returned by mm_malloc) or NULL
+void mm_setroot(void *ptr);
+
+/// @brief retrieve the application's root pointer
+/// @retval void* root pointer set by mm_setroot() (adjusted if the heap has been relocated)
+/// @retval NULL if no root pointer has been set
+void* mm_getroot(void);
+
 /// @brief set log level
 /// @brief level log level (0: no logging, 1: info; 2: verbose)
 void mm_setloglevel(int level);
 
+/// @brief enable or disable the granule bitmap for the first and next fit policies. With the
+///        bitmap, free block searches scan one bit per BS-byte granule a word at a time instead of
+///        walking the boundary tags. Takes effect at the next mm_init().
+/// @param enable 1: use bitmap, 0: walk boundary tags (default)
+void mm_setbitmap(int enable);
+
+/// @brief set the heap growth policy (all policies except buddy, whose arena doubles). When the
+///        heap must be extended, it grows by the larger of the shortfall and the top pad: the used
+///        heap >> @a shift, capped at @a cap and rounded up to a multiple of @a chunk, but at least
+///        @a chunk bytes. A growing heap thus calls ds_sbrk() O(log n) times up to the cap and
+///        O(n / cap) times beyond it. The same pad is kept when a free top block is trimmed. The
+///        chunk also sets the initial heap size and takes effect at the next mm_init().
+/// @param chunk minimal extension in bytes (0: MM_GROWTH_CHUNK)
+/// @param shift geometric growth factor 1/2^shift (0: grow by @a chunk only)
+/// @param cap maximal geometric extension in bytes (0: unlimited)
+void mm_setgrowth(size_t chunk, unsigned int shift, size_t cap);
+
+/// @brief number of blocks of one size class in a mm_reserve() profile
+typedef struct {
+  size_t        size;             ///< payload size in bytes
+  unsigned long count;            ///< number of blocks
+} MMSizeClass;
+
+/// @brief pre-warm the heap for a size-class profile, e.g., the peak number of live blocks per
+///        size class of a previous run. The heap is extended once to hold all blocks and is not
+///        trimmed below that size afterwards, and its pages are faulted in. For TLSF and buddy,
+///        the space is also pre-split into free blocks of the profile's classes, so that the
+///        first allocations neither extend the heap nor split blocks. The other policies keep the
+///        reserved space as the top block, which they carve without a search. Call at startup.
+/// @param profile array of @a nclasses size classes
+/// @param nclasses number of size classes
+/// @retval 0 on success
+/// @retval -1 if the heap cannot hold the profile (blocks pre-split up to then are kept)
+int mm_reserve(const MMSizeClass *profile, size_t nclasses);
+
+/// @brief return the physical pages of free blocks of at least @a min_size bytes to the OS
+///        (madvise(MADV_DONTNEED) on the page-aligned interior of each block). Purged pages read
+///        as zero when reused. No-op for file-backed heaps.
+/// @param min_size minimal size of a free block to be purged, in bytes
+/// @retval size_t number of bytes newly purged
+size_t mm_purge(size_t min_size);
+
+/// @brief automatically purge free blocks of at least @a threshold bytes whenever mm_free()
+///        produces one (see mm_purge()). Applies to all policies except buddy.
+/// @param threshold minimal size of a coalesced free block to be purged (0: off, default)
+void mm_setpurge(size_t threshold);
+
+/// @brief retrieve the number of purged bytes in free blocks
+/// @retval size_t purged bytes
+size_t mm_purged(void);
+
+/// @brief handle of a relocatable block (0: invalid)
+typedef size_t MMHandle;
+
+/// @brief statistics of a mm_compact() step
+typedef struct {
+  unsigned long nmoved;           ///< number of blocks moved
+  size_t        moved;            ///< number of bytes moved
+  size_t        recovered;        ///< number of bytes the heap shrank by
+  unsigned long pause;            ///< duration of the step in nanoseconds
+} MMCompactStat;
+
+/// @brief allocate a relocatable block of @a size bytes. The block is only accessible through
+///        mm_hlock(); while it is not locked, mm_compact() may move it.
+/// @param size number of bytes
+/// @retval MMHandle handle of the block on success
+/// @retval 0 if memory allocation failed
+MMHandle mm_halloc(size_t size);
+
+/// @brief pin the block of handle @a h and return its address. Locks nest; the block does not
+///        move until every mm_hlock() has been matched by a mm_hunlock().
+/// @param h handle
+/// @retval void* pointer to the first byte of the block
+void* mm_hlock(MMHandle h);
+
+/// @brief unpin the block of handle @a h. Pointers returned by mm_hlock() become invalid once the
+///        lock count drops to zero.
+/// @param h handle
+void mm_hunlock(MMHandle h);
+
+/// @brief free the block of handle @a h (which must not be locked). Unlike mm_free(), must only
+///        be called by the owner of the heap.
+/// @param h handle (0: no-op)
+void mm_hfree(MMHandle h);
+
+/// @brief compact the heap incrementally: slide unlocked relocatable blocks toward heap_start
+///        into the free blocks below them, continuing where the previous call stopped. When a
+///        pass reaches the end of the heap, the free top block is trimmed (sbrk) and the next call
+///        starts a new pass. Allocated blocks that are not relocatable or locked stay in place.
+///        No-op for the buddy policy.
+/// @param budget work limit of this step: bytes moved plus BS bytes per visited block (0: none)
+/// @param[out] stat statistics of this step (may be NULL)
+/// @retval 1 if the step completed a pass
+/// @retval 0 if more work remains
+int mm_compact(size_t budget, MMCompactStat *stat);
+
+/// @brief write a compact binary snapshot of the block map (MMSnapshotHeader followed by one tag
+///        per block) to @a fd. The heap is walked once; tags are buffered and written in large
+///        chunks so that snapshots are cheap enough to be taken periodically.
+/// @param fd file descriptor opened for writing
+/// @retval 0 on success
+/// @retval -1 on error. errno is set by write()
+int mm_snapshot(int fd);
+
+/// @brief retrieve free block search statistics since the last mm_init()
+/// @param[out] searches number of free block searches (one per allocation that searched the heap)
+/// @param[out] visited  number of blocks inspected by all searches
+void mm_search_stat(unsigned long *searches, unsigned long *visited);
+
 /// @brief dump heap and perform some sanity checks
 void mm_check(void);
 
@@ -0,0 +1,627 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief trace replay benchmark for the dynamic memory manager
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+//
+// Trace replay benchmark
+// ======================
+// Replays the allocation actions of one or more driver scripts (tests/*.dmas) against every
+// selected allocation policy and prints one line of statistics per script and policy.
+//
+// Only the actions of a script are replayed:
+//   m <id> <size>     malloc
+//   c <id> <size>     calloc
+//   r <id> <size>     realloc
+//   f <id>            free
+//   F <id>            sized free (mm_free_sized() with the usable size of the block)
+//   x <id> <size>     grow in place (mm_try_expand(); ignored with -C)
+// plus the 'dataseg <size>' setting. Everything else (log levels, modes, checks) is ignored. For
+// scripts with sized frees, the usable size (mm_usable_size()) of every block is recorded after
+// each action, as a caller of mm_free_sized() has to.
+//
+// Reported per policy: total replay time and throughput, final utilization (live payload / heap
+// size), number of sbrk() calls, average number of blocks (lists, bitmap words) visited per free
+// block search, and the 99.9th percentile and worst-case latency of a single action.
+//
+// The granule and minimal block size are selected at build time; 'make bench-granule' builds
+// mm_bench for every granule and replays all tests/*.dmas traces with each of them. It then
+// builds mm_bench and mm_regress with DEBUG for every combination in GRANULE_CHECKS, replays the
+// traces in tests/check/ with -c, which runs mm_check() at the end of each replay, and runs the
+// regression checks of mm_regress.
+//
+// With -s <prefix>, heap snapshots (see mm_snapshot()) are written halfway through and at the end
+// of the replay to <prefix>.<policy>.{mid,end}.snap and the time taken by each is reported. The
+// two files can be compared with mm_snapdiff.
+//
+// With -P, all free blocks are purged (mm_purge()) at the end of the replay and the resident set
+// size of the process before and after the purge is reported.
+//
+// With -t <prefix>, the throughput run is traced (tr_start()) and the trace is written to
+// <prefix>.<policy>.trace for mm_tracedump. The reported throughput then includes the tracing
+// overhead.
+//
+// With -g <chunk>[,<shift>[,<cap>]], the heap growth policy is set with mm_setgrowth() (defaults
+// MM_GROWTH_CHUNK, MM_GROWTH_SHIFT, MM_GROWTH_CAP); the #sbrk column shows its effect.
+//
+// With -R, every replay is repeated on a heap pre-warmed with mm_reserve(). The profile is the
+// peak number of live blocks per size class (16-byte steps up to 128 bytes, then four classes per
+// power of two) of the script itself, as a previous run of the same workload would have recorded.
+// The cold-start latency (sum and maximum of the first COLD_ACTIONS actions, and the number of
+// sbrk() calls until then) is reported without and with the reservation, together with the time
+// mm_reserve() takes.
+//
+// With -C <budget>, the blocks are allocated as relocatable blocks through the handle API
+// (mm_halloc(); realloc allocates a new block and copies) and the heap is compacted incrementally
+// with mm_compact(<budget>) every COMPACT_INTERVAL actions. The number of compaction steps, their
+// average and maximal pause, and the bytes moved are reported, followed by a final full compaction
+// pass and the heap size before and after it. Buddy does not move blocks.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+#include "trace.h"
+
+
+/// @brief a single allocation action of a script
+typedef struct {
+  char   op;                      ///< action (m, c, r, f, F, x)
+  long   id;                      ///< block id
+  size_t size;                    ///< payload size (unused for f)
+} Action;
+
+/// @brief a parsed script
+typedef struct {
+  const char *name;               ///< file name
+  size_t     dssize;              ///< data segment size
+  Action     *action;             ///< actions
+  size_t     nactions;            ///< number of actions
+  long       maxid;               ///< largest block id
+  int        sized;               ///< script contains sized frees (F)
+  MMSizeClass *profile;           ///< size-class profile for mm_reserve() (-R)
+  size_t     nclasses;            ///< number of size classes in profile
+} Script;
+
+/// @brief allocation policies known to the benchmark
+static const struct {
+  const char       *name;         ///< name as used on the command line and in scripts
+  AllocationPolicy ap;            ///< policy
+  int              bitmap;        ///< search granule bitmap (mm_setbitmap())
+} policies[] = {
+  { "firstfit",    ap_FirstFit, 0 },
+  { "firstfit-bm", ap_FirstFit, 1 },
+  { "nextfit",     ap_NextFit,  0 },
+  { "nextfit-bm",  ap_NextFit,  1 },
+  { "bestfit",     ap_BestFit,  0 },
+  { "buddy",       ap_Buddy,    0 },
+  { "tlsf",        ap_TLSF,     0 },
+};
+
+#define NPOLICIES          (sizeof(policies)/sizeof(policies[0]))  ///< number of policies
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))                 ///< MIN function
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))                 ///< MAX function
+#define DEFAULT_DSSIZE     0x4000000                               ///< default data segment size
+
+static const char *snap_prefix = NULL;  ///< prefix of snapshot files (NULL: no snapshots)
+static int do_purge = 0;                ///< purge free blocks at the end of the replay
+static const char *trace_prefix = NULL; ///< prefix of trace files (NULL: no tracing)
+static long compact_budget = -1;        ///< compaction budget in handle mode (-1: no handles)
+static size_t growth_chunk = MM_GROWTH_CHUNK;  ///< minimal heap extension (mm_setgrowth())
+static unsigned int growth_shift = MM_GROWTH_SHIFT; ///< geometric growth factor (mm_setgrowth())
+static size_t growth_cap = MM_GROWTH_CAP;      ///< maximal geometric extension (mm_setgrowth())
+static int do_reserve = 0;              ///< compare cold start with and without mm_reserve()
+static int do_check = 0;                ///< run mm_check() at the end of the replay
+static unsigned long reserve_time = 0;  ///< duration of the last mm_reserve() in nanoseconds
+static ssize_t reserve_nsbrk = 0;       ///< sbrk() calls before the first action (mm_reserve())
+static ssize_t cold_nsbrk = 0;          ///< sbrk() calls during the first COLD_ACTIONS actions
+
+#define COLD_ACTIONS       1000                                    ///< actions of a cold start
+
+#define COMPACT_INTERVAL   100                                     ///< actions between compactions
+
+
+/// @brief size class of a payload of @a size bytes for the -R profile (upper bound of the class)
+static size_t size_class(size_t size)
+{
+  if (size <= 128) return (size + 15) / 16 * 16;
+
+  size_t g = 1UL << (63 - __builtin_clzl(size - 1) - 2);
+  return (size + g - 1) / g * g;
+}
+
+/// @brief record the peak number of live blocks per size class of script @a s in s->profile
+static void build_profile(Script *s)
+{
+  size_t *cls = calloc(s->maxid + 1, sizeof(size_t));
+  unsigned long *live = NULL;
+  size_t capacity = 0;
+
+  if (cls == NULL) {
+    fprintf(stderr, "ERROR: out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < s->nactions; i++) {
+    const Action *a = &s->action[i];
+    if (a->id < 0) continue;
+
+    // the old block of the id (if any) is no longer live
+    if (cls[a->id] != 0) {
+      for (size_t c = 0; c < s->nclasses; c++) {
+        if (s->profile[c].size == cls[a->id]) live[c]--;
+      }
+      cls[a->id] = 0;
+    }
+    if ((a->op == 'f') || (a->op == 'F') || (a->size == 0)) continue;
+
+    size_t c = 0, size = size_class(a->size);
+    while ((c < s->nclasses) && (s->profile[c].size != size)) c++;
+    if (c == s->nclasses) {
+      if (s->nclasses == capacity) {
+        capacity = capacity ? 2*capacity : 64;
+        s->profile = realloc(s->profile, capacity*sizeof(MMSizeClass));
+        live = realloc(live, capacity*sizeof(unsigned long));
+        if ((s->profile == NULL) || (live == NULL)) {
+          fprintf(stderr, "ERROR: out of memory.\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      s->profile[c] = (MMSizeClass){ size, 0 };
+      live[c] = 0;
+      s->nclasses++;
+    }
+
+    cls[a->id] = size;
+    if (++live[c] > s->profile[c].count) s->profile[c].count = live[c];
+  }
+
+  free(live);
+  free(cls);
+}
+
+/// @brief read and parse a script. Terminates the process on error.
+/// @param fn file name
+/// @param[out] s parsed script
+static void read_script(const char *fn, Script *s)
+{
+  FILE *f = fopen(fn, "r");
+  if (f == NULL) {
+    fprintf(stderr, "ERROR: cannot open '%s': %s.\n", fn, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  memset(s, 0, sizeof(*s));
+  s->name = fn;
+  s->dssize = DEFAULT_DSSIZE;
+  s->maxid = -1;
+
+  size_t capacity = 0;
+  char *line = NULL;
+  size_t llen = 0;
+
+  while (getline(&line, &llen, f) > 0) {
+    Action a = { 0 };
+    unsigned long size;
+
+    if (sscanf(line, "dataseg %li", (long*)&size) == 1) {
+      s->dssize = size;
+      continue;
+    }
+
+    int n = sscanf(line, " %c %ld %lu", &a.op, &a.id, &a.size);
+    if (((n == 3) && (strchr("mcrx", a.op) != NULL)) ||
+        ((n >= 2) && (strchr("fF", a.op) != NULL))) {
+      if (s->nactions == capacity) {
+        capacity = capacity ? 2*capacity : 1024;
+        s->action = realloc(s->action, capacity*sizeof(Action));
+        if (s->action == NULL) {
+          fprintf(stderr, "ERROR: out of memory.\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      s->action[s->nactions++] = a;
+      if (a.op == 'F') s->sized = 1;
+      if (a.id > s->maxid) s->maxid = a.id;
+    }
+  }
+
+  free(line);
+  fclose(f);
+}
+
+/// @brief current time in nanoseconds
+static unsigned long now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000UL + ts.tv_nsec;
+}
+
+/// @brief results of one replay
+typedef struct {
+  double        elapsed;          ///< total time in seconds
+  double        util;             ///< final utilization (payload / heap size) in percent
+  ssize_t       nsbrk;            ///< number of sbrk() calls
+  double        search;           ///< average number of blocks visited per search
+  unsigned long snap[2];          ///< time to take the mid/end snapshot in nanoseconds
+  size_t        rss[2];           ///< resident set size before/after purging in bytes
+  size_t        purged;           ///< bytes purged
+  unsigned long purge_time;       ///< time to purge in nanoseconds
+  unsigned long ncompact;         ///< number of incremental compaction steps
+  unsigned long pause[2];         ///< total/maximal pause of the compaction steps in nanoseconds
+  size_t        moved;            ///< bytes moved by the compaction steps
+  MMCompactStat final;            ///< final full compaction pass
+  size_t        heap[2];          ///< heap size before/after the final pass in bytes
+} Result;
+
+/// @brief resident set size of the process in bytes
+static size_t rss(void)
+{
+  unsigned long size, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+  }
+  return resident * getpagesize();
+}
+
+/// @brief write a snapshot of the current heap to <snap_prefix>.<policy>.<tag>.snap
+/// @retval time taken by mm_snapshot() in nanoseconds
+static unsigned long snapshot(int p, const char *tag)
+{
+  char fn[4096];
+  snprintf(fn, sizeof(fn), "%s.%s.%s.snap", snap_prefix, policies[p].name, tag);
+
+  int fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: cannot create '%s': %s.\n", fn, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned long t = now();
+  if (mm_snapshot(fd) < 0) {
+    fprintf(stderr, "ERROR: cannot write '%s': %s.\n", fn, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  t = now() - t;
+
+  close(fd);
+  return t;
+}
+
+/// @brief write the recorded trace to <trace_prefix>.<policy>.trace
+static void write_trace(int p)
+{
+  char fn[4096];
+  snprintf(fn, sizeof(fn), "%s.%s.trace", trace_prefix, policies[p].name);
+
+  int fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ((fd < 0) || (tr_dump(fd) < 0)) {
+    fprintf(stderr, "ERROR: cannot write '%s': %s.\n", fn, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+}
+
+/// @brief replay script @a s with allocation policy @a p on a fresh heap
+/// @param s script
+/// @param p index into policies[]
+/// @param[out] res results (may be NULL)
+/// @param[out] lat if not NULL, latency of each action in nanoseconds
+/// @param reserve pre-warm the heap with the script's profile (mm_reserve())
+static void run(const Script *s, int p, Result *res, unsigned long *lat, int reserve)
+{
+  void **ptr = calloc(s->maxid + 1, sizeof(void*));
+  size_t *size = calloc(s->maxid + 1, sizeof(size_t));
+  MMHandle *hd = calloc(s->maxid + 1, sizeof(MMHandle));
+  size_t *usable = s->sized ? calloc(s->maxid + 1, sizeof(size_t)) : NULL;
+  size_t payload = 0;
+
+  if ((ptr == NULL) || (size == NULL) || (hd == NULL) || (s->sized && (usable == NULL))) {
+    fprintf(stderr, "ERROR: out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  ds_allocate(s->dssize);
+  mm_setbitmap(policies[p].bitmap);
+  mm_setgrowth(growth_chunk, growth_shift, growth_cap);
+  mm_init(policies[p].ap);
+  if (reserve) {
+    unsigned long t = now();
+    if (mm_reserve(s->profile, s->nclasses) != 0) fprintf(stderr, "WARNING: reservation failed.\n");
+    reserve_time = now() - t;
+  }
+  reserve_nsbrk = ds_getnsbrk();
+  if ((res != NULL) && (trace_prefix != NULL) && (tr_start(0, 0) < 0)) {
+    fprintf(stderr, "ERROR: cannot allocate trace buffer.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned long start = now(), t = start;
+  for (size_t i = 0; i < s->nactions; i++) {
+    const Action *a = &s->action[i];
+    if (a->id < 0) continue;
+
+    size_t nsize = a->size;
+    if (compact_budget < 0) {
+      switch (a->op) {
+        case 'm': ptr[a->id] = mm_malloc(a->size);    break;
+        case 'c': ptr[a->id] = mm_calloc(1, a->size); break;
+        case 'r': ptr[a->id] = mm_realloc(ptr[a->id], a->size); break;
+        case 'f': mm_free(ptr[a->id]); ptr[a->id] = NULL; break;
+        case 'F': mm_free_sized(ptr[a->id], usable[a->id]); ptr[a->id] = NULL; break;
+        case 'x': if (!mm_try_expand(ptr[a->id], a->size)) nsize = size[a->id]; break;
+      }
+      // the caller of a sized free has to know the usable size (see mm_free_sized())
+      if ((usable != NULL) && (ptr[a->id] != NULL)) usable[a->id] = mm_usable_size(ptr[a->id]);
+    } else {
+      MMHandle h = 0;
+      switch (a->op) {
+        case 'm':
+        case 'c':
+          h = mm_halloc(a->size);
+          if ((h != 0) && (a->op == 'c')) {
+            memset(mm_hlock(h), 0, a->size);
+            mm_hunlock(h);
+          }
+          break;
+        case 'r':
+          h = a->size > 0 ? mm_halloc(a->size) : 0;
+          if ((h != 0) && (hd[a->id] != 0)) {
+            memcpy(mm_hlock(h), mm_hlock(hd[a->id]), MIN(size[a->id], a->size));
+            mm_hunlock(hd[a->id]);
+            mm_hunlock(h);
+          }
+          if ((h == 0) && (a->size > 0)) h = hd[a->id]; // old block is left untouched
+          else mm_hfree(hd[a->id]);
+          break;
+        case 'f':
+        case 'F': mm_hfree(hd[a->id]); break;
+        case 'x': h = hd[a->id]; nsize = size[a->id]; break;
+      }
+      hd[a->id] = h;
+
+      if ((i % COMPACT_INTERVAL == 0) && (res != NULL)) {
+        MMCompactStat st;
+        mm_compact(compact_budget, &st);
+        res->ncompact++;
+        res->pause[0] += st.pause;
+        res->pause[1] = MAX(res->pause[1], st.pause);
+        res->moved += st.moved;
+      } else if (i % COMPACT_INTERVAL == 0) {
+        mm_compact(compact_budget, NULL);
+      }
+    }
+
+    if (lat != NULL) {
+      unsigned long u = now();
+      lat[i] = u - t;
+      t = u;
+      if (i + 1 == COLD_ACTIONS) cold_nsbrk = ds_getnsbrk();
+    }
+
+    payload -= size[a->id];
+    int live = compact_budget < 0 ? ptr[a->id] != NULL : hd[a->id] != 0;
+    size[a->id] = live ? nsize : 0;
+    payload += size[a->id];
+
+    if ((res != NULL) && (snap_prefix != NULL) && (i == s->nactions/2)) {
+      unsigned long u = now();
+      res->snap[0] = snapshot(p, "mid");
+      start += now() - u;
+    }
+  }
+
+  if (res != NULL) {
+    void *heap_start, *heap_brk;
+    unsigned long searches, visited;
+
+    res->elapsed = (now() - start)*1e-9;
+    if (trace_prefix != NULL) {
+      tr_stop();
+      write_trace(p);
+    }
+    ds_heap_stat(&heap_start, &heap_brk, NULL);
+    res->util = heap_brk > heap_start ? 100.0*payload/(heap_brk - heap_start) : 0.0;
+    res->nsbrk = ds_getnsbrk();
+    mm_search_stat(&searches, &visited);
+    res->search = searches > 0 ? (double)visited/searches : 0.0;
+    if (snap_prefix != NULL) res->snap[1] = snapshot(p, "end");
+    if (compact_budget >= 0) {
+      res->heap[0] = heap_brk - heap_start;
+      while (!mm_compact(0, &res->final));
+      ds_heap_stat(&heap_start, &heap_brk, NULL);
+      res->heap[1] = heap_brk - heap_start;
+    }
+    if (do_check) mm_check();
+    if (do_purge) {
+      res->rss[0] = rss();
+      unsigned long t = now();
+      res->purged = mm_purge(0);
+      res->purge_time = now() - t;
+      res->rss[1] = rss();
+    }
+  }
+
+  ds_release();
+  free(usable);
+  free(hd);
+  free(size);
+  free(ptr);
+}
+
+/// @brief qsort comparison function for latencies
+static int cmp_lat(const void *a, const void *b)
+{
+  unsigned long x = *(const unsigned long*)a, y = *(const unsigned long*)b;
+  return (x > y) - (x < y);
+}
+
+/// @brief replay script @a s with allocation policy @a p and print the results. Throughput is
+///        measured in a first run, per-action latencies in a second one so that reading the clock
+///        after every action does not distort the throughput.
+/// @param s script
+/// @param p index into policies[]
+static void replay(const Script *s, int p)
+{
+  Result res = { 0 };
+  unsigned long *lat = calloc(s->nactions + 1, sizeof(unsigned long));
+  if (lat == NULL) {
+    fprintf(stderr, "ERROR: out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned long cold[2][2] = { { 0 } };   // sum/maximum of the first actions w/o and with -R
+  ssize_t cold_sbrk[2] = { 0 };
+  size_t ncold = s->nactions < COLD_ACTIONS ? s->nactions : COLD_ACTIONS;
+
+  run(s, p, &res, NULL, 0);
+  for (int r = do_reserve; r >= 0; r--) {
+    cold_nsbrk = 0;
+    run(s, p, NULL, lat, r);
+    for (size_t i = 0; i < ncold; i++) {
+      cold[r][0] += lat[i];
+      if (lat[i] > cold[r][1]) cold[r][1] = lat[i];
+    }
+    cold_sbrk[r] = (ncold < COLD_ACTIONS ? ds_getnsbrk() : cold_nsbrk) - reserve_nsbrk;
+  }
+  qsort(lat, s->nactions, sizeof(unsigned long), cmp_lat);
+
+  size_t n = s->nactions;
+  printf("  %-12s %8lu %10.6f %10.2f %7.1f%% %8ld %10.2f %10lu %10lu\n",
+         policies[p].name, n, res.elapsed, n/res.elapsed/1000.0, res.util, res.nsbrk, res.search,
+         n > 0 ? lat[(n - 1)*999/1000] : 0, n > 0 ? lat[n - 1] : 0);
+  if (snap_prefix != NULL) {
+    printf("  %-12s snapshot: %lu ns (mid), %lu ns (end)\n", "", res.snap[0], res.snap[1]);
+  }
+  if (do_reserve) {
+    printf("  %-12s cold start: first %lu actions %lu us (max %lu ns), %ld sbrk\n", "", ncold,
+           cold[0][0] / 1000, cold[0][1], cold_sbrk[0]);
+    printf("  %-12s reserved:   first %lu actions %lu us (max %lu ns), %ld sbrk, "
+           "mm_reserve() %lu us\n", "", ncold, cold[1][0] / 1000, cold[1][1], cold_sbrk[1],
+           reserve_time / 1000);
+  }
+  if (compact_budget >= 0) {
+    printf("  %-12s compact: %lu steps, pause avg %lu ns, max %lu ns, moved %lu KB\n", "",
+           res.ncompact, res.ncompact > 0 ? res.pause[0]/res.ncompact : 0, res.pause[1],
+           res.moved >> 10);
+    printf("  %-12s final pass: %lu us, moved %lu KB, heap %lu KB -> %lu KB\n", "",
+           res.final.pause / 1000, res.final.moved >> 10, res.heap[0] >> 10, res.heap[1] >> 10);
+  }
+  if (do_purge) {
+    printf("  %-12s purge: %lu KB in %lu us, rss %lu KB -> %lu KB\n", "", res.purged >> 10,
+           res.purge_time / 1000, res.rss[0] >> 10, res.rss[1] >> 10);
+  }
+
+  free(lat);
+}
+
+/// @brief print usage and terminate
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [-p <policy>]... [-s <prefix>] [-t <prefix>] [-P] [-R] [-C <budget>]\n"
+                  "          [-g <chunk>[,<shift>[,<cap>]]] [-c] <script(s)>\n"
+                  "  -c             check the heap (mm_check()) at the end of every replay\n"
+                  "  -C <budget>    use relocatable blocks and compact with <budget> every %d actions\n"
+                  "  -g <chunk>[,<shift>[,<cap>]]\n"
+                  "                 extend the heap by >= max(chunk, min(used >> shift, cap)) bytes\n"
+                  "  -R             compare the cold start with and without mm_reserve()\n"
+                  "  -P             purge free blocks at the end and report RSS before/after\n"
+                  "  -s <prefix>    write heap snapshots to <prefix>.<policy>.{mid,end}.snap\n"
+                  "  -t <prefix>    trace the replay into <prefix>.<policy>.trace\n"
+                  "  -p <policy>    replay with <policy> only (may be given several times)\n"
+                  "                 default: all of", argv0, COMPACT_INTERVAL);
+  for (size_t p = 0; p < NPOLICIES; p++) fprintf(stderr, " %s", policies[p].name);
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int selected[NPOLICIES] = { 0 }, nselected = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:s:t:C:g:RPch")) != -1) {
+    switch (opt) {
+      case 'p': {
+        size_t p = 0;
+        while ((p < NPOLICIES) && (strcmp(optarg, policies[p].name) != 0)) p++;
+        if (p == NPOLICIES) syntax(argv[0]);
+        selected[p] = 1;
+        nselected++;
+        break;
+      }
+      case 's': snap_prefix = optarg; break;
+      case 't': trace_prefix = optarg; break;
+      case 'P': do_purge = 1; break;
+      case 'R': do_reserve = 1; break;
+      case 'c': do_check = 1; break;
+      case 'g':
+        if (sscanf(optarg, "%zi,%u,%zi", &growth_chunk, &growth_shift, &growth_cap) < 1)
+          syntax(argv[0]);
+        break;
+      case 'C': compact_budget = atol(optarg); if (compact_budget < 0) syntax(argv[0]); break;
+      default: syntax(argv[0]);
+    }
+  }
+  if (optind == argc) syntax(argv[0]);
+
+  printf("granule %d bytes, minimal block %d bytes\n", MM_GRANULE, MM_MIN_BLOCK);
+  printf("growth chunk %zu bytes, used heap >> %u, cap %zu bytes\n\n",
+         growth_chunk, growth_shift, growth_cap);
+
+  for (int i = optind; i < argc; i++) {
+    Script s;
+    read_script(argv[i], &s);
+    if (do_reserve) build_profile(&s);
+
+    printf("%s\n", s.name);
+    printf("  %-12s %8s %10s %10s %8s %8s %10s %10s %10s\n",
+           "policy", "actions", "time [s]", "kops/sec", "util", "#sbrk", "search",
+           "p99.9 [ns]", "max [ns]");
+    for (size_t p = 0; p < NPOLICIES; p++) {
+      if ((nselected == 0) || selected[p]) replay(&s, p);
+    }
+    printf("\n");
+
+    free(s.profile);
+    free(s.action);
+  }
+
+  return EXIT_SUCCESS;
+}
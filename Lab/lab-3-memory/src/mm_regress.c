@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief regression checks: short call sequences that once corrupted the heap
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+
+//
+// Regression checks
+// =================
+// Runs short call sequences that once broke the heap against every policy they apply to and
+// checks the results. Prints one line per check and policy and exits with EXIT_FAILURE if any
+// check failed. 'make bench-granule' runs it for every granule and minimal block size.
+//
+// Checks:
+//   slide     a relocatable block slid by mm_compact() into a purged free block leaves a free
+//             block header behind in a purged page; mm_calloc() must still return zeroed memory
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+
+#define DSSIZE             0x4000000                   ///< data segment size
+#define PURGE_SIZE         0x10000                     ///< size of the purged free block
+
+
+/// @brief allocation policies the checks run against. Buddy neither moves blocks nor trusts the
+///        purge bitmap.
+static const struct {
+  const char       *name;         ///< name
+  AllocationPolicy ap;            ///< policy
+  int              bitmap;        ///< search granule bitmap (mm_setbitmap())
+} policies[] = {
+  { "firstfit",    ap_FirstFit, 0 },
+  { "firstfit-bm", ap_FirstFit, 1 },
+  { "nextfit",     ap_NextFit,  0 },
+  { "nextfit-bm",  ap_NextFit,  1 },
+  { "bestfit",     ap_BestFit,  0 },
+  { "tlsf",        ap_TLSF,     0 },
+};
+
+#define NPOLICIES          (sizeof(policies)/sizeof(policies[0]))  ///< number of policies
+
+
+/// @brief slide a relocatable block into a purged free block so that the free block behind it
+///        starts on a page boundary, free it, and calloc() the space
+/// @retval NULL if the check passed
+/// @retval error message otherwise
+static const char* check_slide(void)
+{
+  size_t pagesize = ds_getpagesize();
+
+  mm_malloc(64);
+  char *f = mm_malloc(PURGE_SIZE);
+
+  // the slid block covers f's header (the word in front of the payload) up to a page boundary
+  // inside the purged pages; the handle takes one more word in front of the data
+  uintptr_t header = (uintptr_t)f - sizeof(uint64_t);
+  size_t bsize = 2*pagesize - header % pagesize;
+  MMHandle h = mm_halloc(bsize - 3*sizeof(uint64_t));
+  mm_malloc(64);
+  if ((f == NULL) || (h == 0)) return "cannot allocate";
+
+  mm_free(f);
+  if (mm_purge(0) == 0) return "nothing purged";
+  while (!mm_compact(0, NULL));
+  char *p = mm_hlock(h);
+  mm_hunlock(h);
+  if (p != f + sizeof(uint64_t)) return "block not moved";
+  mm_hfree(h);
+
+  size_t len = bsize + 2*pagesize;
+  unsigned char *c = mm_calloc(1, len);
+  if (c == NULL) return "cannot allocate";
+  for (size_t i = 0; i < len; i++) {
+    if (c[i] != 0) return "calloc() returned non-zero memory";
+  }
+  return NULL;
+}
+
+/// @brief regression checks
+static const struct {
+  const char *name;               ///< name
+  const char* (*check)(void);     ///< check function
+} checks[] = {
+  { "slide", check_slide },
+};
+
+#define NCHECKS            (sizeof(checks)/sizeof(checks[0]))      ///< number of checks
+
+
+int main(int argc, char *argv[])
+{
+  int failed = 0;
+
+  printf("granule %d bytes, minimal block %d bytes\n", MM_GRANULE, MM_MIN_BLOCK);
+  for (size_t c = 0; c < NCHECKS; c++) {
+    for (size_t p = 0; p < NPOLICIES; p++) {
+      ds_allocate(DSSIZE);
+      mm_setbitmap(policies[p].bitmap);
+      mm_init(policies[p].ap);
+
+      const char *error = checks[c].check();
+      printf("  %-8s %-12s %s\n", checks[c].name, policies[p].name, error ? error : "ok");
+      if (error != NULL) failed++;
+
+      ds_release();
+    }
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief compare two heap snapshots taken with mm_snapshot()
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+//
+// Heap snapshot diff
+// ==================
+// Reads two snapshots written by mm_snapshot() and reports, grouped by power-of-two size class,
+//   - the live (allocated) blocks in both snapshots,
+//   - new live blocks: allocated in the second snapshot but not (at the same offset and with the
+//     same size) in the first one,
+//   - freed blocks: allocated in the first snapshot but not in the second one,
+//   - free blocks in both snapshots,
+// followed by the fragmentation of both heaps (free bytes, largest free block, and external
+// fragmentation = 1 - largest free block / free bytes) and their difference.
+//
+// Blocks are identified by their offset from heap_start, so snapshots of a relocated heap can be
+// compared as well. With -v, every new live and freed block is listed.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memmgr.h"
+
+#define STATUS_MASK        ((uint64_t)0x7)             ///< mask to retrieve flags from block tag
+#define ALLOC              1                           ///< block allocated flag
+#define NCLASSES           48                          ///< number of size classes
+
+/// @brief a snapshot in memory
+typedef struct {
+  const char       *name;         ///< file name
+  MMSnapshotHeader hdr;           ///< header
+  uint64_t         *tag;          ///< block tags
+} Snapshot;
+
+/// @brief per size class statistics
+typedef struct {
+  unsigned long    count;         ///< number of blocks
+  unsigned long    bytes;         ///< sum of block sizes
+} Stat;
+
+/// @brief load snapshot from file @a fn. Terminates the process on error.
+static void load(const char *fn, Snapshot *s)
+{
+  FILE *f = fopen(fn, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "ERROR: cannot open '%s': %s.\n", fn, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  s->name = fn;
+  if ((fread(&s->hdr, sizeof(s->hdr), 1, f) != 1) ||
+      (memcmp(s->hdr.magic, MM_SNAPSHOT_MAGIC, sizeof(s->hdr.magic)) != 0))
+  {
+    fprintf(stderr, "ERROR: '%s' is not a heap snapshot.\n", fn);
+    exit(EXIT_FAILURE);
+  }
+
+  s->tag = malloc(s->hdr.nblocks*sizeof(uint64_t) + 1);
+  if ((s->tag == NULL) || (fread(s->tag, sizeof(uint64_t), s->hdr.nblocks, f) != s->hdr.nblocks)) {
+    fprintf(stderr, "ERROR: cannot read %lu blocks from '%s'.\n", s->hdr.nblocks, fn);
+    exit(EXIT_FAILURE);
+  }
+
+  fclose(f);
+}
+
+/// @brief size class of a block of @a size bytes (floor(log2(size)))
+static int size_class(uint64_t size)
+{
+  return size > 0 ? 63 - __builtin_clzl(size) : 0;
+}
+
+/// @brief add a block of @a size bytes to @a stat
+static void add(Stat *stat, uint64_t size)
+{
+  stat[size_class(size)].count++;
+  stat[size_class(size)].bytes += size;
+}
+
+/// @brief summarize free space in snapshot @a s
+/// @param[out] free_bytes total size of free blocks
+/// @param[out] largest size of largest free block
+static void free_space(const Snapshot *s, uint64_t *free_bytes, uint64_t *largest)
+{
+  *free_bytes = *largest = 0;
+  for (uint64_t i = 0; i < s->hdr.nblocks; i++) {
+    uint64_t size = s->tag[i] & ~STATUS_MASK;
+    if ((s->tag[i] & ALLOC) == 0) {
+      *free_bytes += size;
+      if (size > *largest) *largest = size;
+    }
+  }
+}
+
+/// @brief external fragmentation in percent
+static double fragmentation(uint64_t free_bytes, uint64_t largest)
+{
+  return free_bytes > 0 ? 100.0*(1.0 - (double)largest/free_bytes) : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+  int verbose = 0, opt;
+
+  while ((opt = getopt(argc, argv, "vh")) != -1) {
+    switch (opt) {
+      case 'v': verbose = 1; break;
+      default:
+        fprintf(stderr, "Syntax: %s [-v] <old snapshot> <new snapshot>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "Syntax: %s [-v] <old snapshot> <new snapshot>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Snapshot s[2];
+  load(argv[optind], &s[0]);
+  load(argv[optind + 1], &s[1]);
+
+  Stat live[2][NCLASSES] = { 0 }, freeblk[2][NCLASSES] = { 0 };
+  Stat added[NCLASSES] = { 0 }, freed[NCLASSES] = { 0 };
+
+  for (int k = 0; k < 2; k++) {
+    for (uint64_t i = 0; i < s[k].hdr.nblocks; i++) {
+      uint64_t size = s[k].tag[i] & ~STATUS_MASK;
+      add((s[k].tag[i] & ALLOC) ? live[k] : freeblk[k], size);
+    }
+  }
+
+  //
+  // merge both block maps by offset. A live block is unchanged if the other snapshot has a live
+  // block with the same offset and size.
+  //
+  uint64_t i = 0, j = 0, oi = 0, oj = 0;
+  while ((i < s[0].hdr.nblocks) || (j < s[1].hdr.nblocks)) {
+    int take_old = (j == s[1].hdr.nblocks) || ((i < s[0].hdr.nblocks) && (oi < oj));
+    int take_new = (i == s[0].hdr.nblocks) || ((j < s[1].hdr.nblocks) && (oj < oi));
+    if (!take_old && !take_new) take_old = take_new = 1;    // same offset
+
+    uint64_t ti = take_old ? s[0].tag[i] : 0, tj = take_new ? s[1].tag[j] : 0;
+    int same = take_old && take_new && (ti == tj);
+
+    if (take_old && (ti & ALLOC) && !same) {
+      add(freed, ti & ~STATUS_MASK);
+      if (verbose) printf("  freed  +0x%lx: size %lu\n", oi, ti & ~STATUS_MASK);
+    }
+    if (take_new && (tj & ALLOC) && !same) {
+      add(added, tj & ~STATUS_MASK);
+      if (verbose) printf("  new    +0x%lx: size %lu\n", oj, tj & ~STATUS_MASK);
+    }
+
+    if (take_old) oi += ti & ~STATUS_MASK, i++;
+    if (take_new) oj += tj & ~STATUS_MASK, j++;
+  }
+  if (verbose) printf("\n");
+
+  printf("old: %s (%lu blocks, heap %lu bytes)\n", s[0].name, s[0].hdr.nblocks,
+         s[0].hdr.heap_end - s[0].hdr.heap_start);
+  printf("new: %s (%lu blocks, heap %lu bytes), %.3f sec later\n", s[1].name, s[1].hdr.nblocks,
+         s[1].hdr.heap_end - s[1].hdr.heap_start,
+         ((double)s[1].hdr.timestamp - (double)s[0].hdr.timestamp)*1e-9);
+  printf("\n");
+  printf("  %-14s %18s %18s %18s %18s %18s %18s\n", "size class",
+         "live (old)", "live (new)", "new live", "freed", "free (old)", "free (new)");
+
+  for (int c = 0; c < NCLASSES; c++) {
+    if (live[0][c].count + live[1][c].count + freeblk[0][c].count + freeblk[1][c].count == 0)
+      continue;
+
+    char range[32];
+    snprintf(range, sizeof(range), "%lu-%lu", 1UL << c, (2UL << c) - 1);
+    printf("  %-14s", range);
+    Stat *col[] = { &live[0][c], &live[1][c], &added[c], &freed[c], &freeblk[0][c], &freeblk[1][c] };
+    for (size_t k = 0; k < sizeof(col)/sizeof(col[0]); k++)
+      printf(" %7lu/%10lu", col[k]->count, col[k]->bytes);
+    printf("\n");
+  }
+
+  uint64_t fb[2], lg[2];
+  free_space(&s[0], &fb[0], &lg[0]);
+  free_space(&s[1], &fb[1], &lg[1]);
+  double fr[2] = { fragmentation(fb[0], lg[0]), fragmentation(fb[1], lg[1]) };
+
+  printf("\n");
+  printf("  %-24s %14s %14s %14s\n", "", "old", "new", "delta");
+  printf("  %-24s %14lu %14lu %+14ld\n", "free bytes", fb[0], fb[1], (long)(fb[1] - fb[0]));
+  printf("  %-24s %14lu %14lu %+14ld\n", "largest free block", lg[0], lg[1], (long)(lg[1] - lg[0]));
+  printf("  %-24s %13.1f%% %13.1f%% %+13.1f%%\n", "external fragmentation", fr[0], fr[1],
+         fr[1] - fr[0]);
+
+  free(s[0].tag);
+  free(s[1].tag);
+
+  return EXIT_SUCCESS;
+}
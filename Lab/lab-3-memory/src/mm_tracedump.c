@@ -0,0 +1,182 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief decode event traces written by tr_dump()
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+//
+// Trace decoder
+// =============
+// Reads a trace written by tr_dump() and prints one line per record (time since tr_start() in
+// microseconds, operation, pointer, size, and the number of blocks visited by the free block
+// search), followed by a per-operation summary. With -s, only the summary is printed.
+//
+// Only every interval-th event carries a timestamp (see tr_start()); the times of the events in
+// between are interpolated linearly between the surrounding timestamps.
+//
+// Nested calls are recorded as well; a mm_realloc() that moves the block, for example, shows up
+// as a malloc and a free followed by the realloc record.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/// @brief per operation statistics
+typedef struct {
+  unsigned long    count;         ///< number of records
+  unsigned long    bytes;         ///< sum of sizes
+  unsigned long    search;        ///< sum of search lengths
+  unsigned long    max_search;    ///< longest search
+} Stat;
+
+/// @brief fill in the timestamps of events that were not sampled by linear interpolation between
+///        the surrounding samples. Events before the first or after the last sample get the
+///        time of that sample.
+/// @param r records, oldest first
+/// @param n number of records
+static void interpolate(TraceRecord *r, uint64_t n)
+{
+  uint64_t prev = n;                            // index of last sample seen (n: none)
+  for (uint64_t i = 0; i < n; i++) {
+    if ((r[i].ticks == 0) || (r[i].op == tr_None)) continue;
+
+    if (prev == n) {
+      for (uint64_t j = 0; j < i; j++) r[j].ticks = r[i].ticks;
+    } else {
+      for (uint64_t j = prev + 1; j < i; j++)
+        r[j].ticks = r[prev].ticks + (r[i].ticks - r[prev].ticks)*(j - prev)/(i - prev);
+    }
+    prev = i;
+  }
+  for (uint64_t j = prev + 1; (prev != n) && (j < n); j++) r[j].ticks = r[prev].ticks;
+}
+
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [-s] <trace>\n"
+                  "  -s             print summary only\n", argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int summary_only = 0, opt;
+
+  while ((opt = getopt(argc, argv, "sh")) != -1) {
+    switch (opt) {
+      case 's': summary_only = 1; break;
+      default: syntax(argv[0]);
+    }
+  }
+  if (argc - optind != 1) syntax(argv[0]);
+
+  const char *fn = argv[optind];
+  FILE *f = fopen(fn, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "ERROR: cannot open '%s': %s.\n", fn, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  TraceHeader hdr;
+  if ((fread(&hdr, sizeof(hdr), 1, f) != 1) ||
+      (memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0))
+  {
+    fprintf(stderr, "ERROR: '%s' is not a trace.\n", fn);
+    return EXIT_FAILURE;
+  }
+
+  // convert ticks to nanoseconds by interpolating between the two calibration points
+  double ns_per_tick = hdr.ticks1 != hdr.ticks0 ?
+                       (double)(hdr.ns1 - hdr.ns0) / (double)(hdr.ticks1 - hdr.ticks0) : 1.0;
+
+  TraceRecord *rec = malloc(hdr.nrecords*sizeof(TraceRecord) + 1);
+  if (rec == NULL) {
+    fprintf(stderr, "ERROR: out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  uint64_t n = fread(rec, sizeof(TraceRecord), hdr.nrecords, f);
+  fclose(f);
+  if (n != hdr.nrecords) fprintf(stderr, "WARNING: trace truncated after %lu records.\n", n);
+  interpolate(rec, n);
+
+  printf("trace: %s (%lu records", fn, hdr.nrecords);
+  if (hdr.nevents > hdr.nrecords) printf(", %lu older events overwritten", hdr.nevents - hdr.nrecords);
+  printf(", %.3f sec, timestamp every %lu events)\n\n", (hdr.ns1 - hdr.ns0)*1e-9, hdr.interval);
+  if (!summary_only)
+    printf("  %14s  %-8s %18s %14s %8s\n", "time [us]", "op", "ptr", "size", "search");
+
+  Stat stat[tr_NumOps] = { 0 };
+  unsigned long unused = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    TraceRecord r = rec[i];
+    if (r.op == tr_None) {
+      unused++;
+      continue;
+    }
+    if (r.op >= tr_NumOps) {
+      fprintf(stderr, "ERROR: invalid operation %u in record %lu.\n", r.op, i);
+      return EXIT_FAILURE;
+    }
+
+    Stat *s = &stat[r.op];
+    s->count++;
+    s->bytes += r.size;
+    s->search += r.search;
+    if (r.search > s->max_search) s->max_search = r.search;
+
+    if (!summary_only) {
+      double us = ((double)(int64_t)(r.ticks - hdr.ticks0)*ns_per_tick)*1e-3;
+      if (r.op == tr_Sbrk)
+        printf("  %14.3f  %-8s %18p %+14ld\n", us, tr_opname[r.op], (void*)r.ptr, (long)r.size);
+      else
+        printf("  %14.3f  %-8s %18p %14lu %8u\n", us, tr_opname[r.op], (void*)r.ptr, r.size,
+               r.search);
+    }
+  }
+  free(rec);
+  if (unused > 0) printf("  (%lu unused slots)\n", unused);
+
+  if (!summary_only) printf("\n");
+  printf("  %-8s %12s %16s %12s %12s\n", "op", "count", "size", "avg search", "max search");
+  for (int op = 0; op < tr_NumOps; op++) {
+    Stat *s = &stat[op];
+    if (s->count == 0) continue;
+    if (op == tr_Sbrk)
+      printf("  %-8s %12lu %+16ld\n", tr_opname[op], s->count, (long)s->bytes);
+    else
+      printf("  %-8s %12lu %16lu %12.2f %12lu\n", tr_opname[op], s->count, s->bytes,
+             (double)s->search/s->count, s->max_search);
+  }
+
+  return EXIT_SUCCESS;
+}
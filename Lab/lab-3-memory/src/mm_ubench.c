@@ -0,0 +1,373 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief microbenchmarks for the allocation hot paths of the dynamic memory manager and glibc
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+//
+// Allocator microbenchmarks
+// =========================
+// Runs a set of synthetic scenarios against every allocation policy and against glibc's malloc
+// and reports the cost of a single allocator call (malloc, calloc, realloc, or free) in ns.
+//
+// Scenarios:
+//   tight     malloc() immediately followed by free(), fixed size
+//   lifo      allocate a batch of BATCH blocks, free them in reverse order
+//   fifo      allocate a batch of BATCH blocks, free them in allocation order
+//   random    replace a random block of a working set of BATCH blocks with one of random size
+//   realloc   grow a buffer in 64-byte steps up to 64 KB with realloc(), then free it
+//   calloc    calloc() immediately followed by free(), fixed size
+//
+// Every scenario is repeated (-r) on a fresh heap; the result is the mean time per call over all
+// repetitions with a 95% confidence interval (Student's t distribution), plus the fastest
+// repetition. With -c, the results are printed as CSV for regression tracking:
+//   scenario,size,allocator,reps,calls,mean_ns,ci95_ns,min_ns
+//
+// With -t, the memmgr allocators run with event tracing (tr_start()) enabled to measure its
+// overhead. The ring buffer wraps; the trace itself is discarded.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+#include "trace.h"
+
+#define BATCH              1000                        ///< blocks per batch / working set size
+#define DSSIZE             0x40000000                  ///< data segment size for memmgr
+#define MAX_REPS           100                         ///< maximal number of repetitions
+#define TRACE_RECORDS      (1 << 16)                   ///< ring buffer size for -t
+
+
+/// @brief an allocator under test
+typedef struct {
+  const char       *name;                              ///< name
+  int              glibc;                              ///< 1: glibc, 0: memmgr
+  AllocationPolicy ap;                                 ///< memmgr policy
+  int              bitmap;                             ///< memmgr granule bitmap
+} Allocator;
+
+static const Allocator allocators[] = {
+  { "glibc",       1, 0,           0 },
+  { "firstfit",    0, ap_FirstFit, 0 },
+  { "firstfit-bm", 0, ap_FirstFit, 1 },
+  { "nextfit",     0, ap_NextFit,  0 },
+  { "nextfit-bm",  0, ap_NextFit,  1 },
+  { "bestfit",     0, ap_BestFit,  0 },
+  { "buddy",       0, ap_Buddy,    0 },
+  { "tlsf",        0, ap_TLSF,     0 },
+};
+
+#define NALLOCATORS        (sizeof(allocators)/sizeof(allocators[0]))  ///< number of allocators
+
+/// @name allocator interface of the current run
+/// @{
+static void* (*xmalloc)(size_t);
+static void* (*xcalloc)(size_t, size_t);
+static void* (*xrealloc)(void*, size_t);
+static void  (*xfree)(void*);
+/// @}
+
+static int trace = 0;                                  ///< trace memmgr allocators (-t)
+
+
+/// @brief a benchmark scenario. Returns the number of allocator calls performed.
+typedef unsigned long (*Scenario)(size_t size, unsigned long n);
+
+/// @brief touch the first byte of a block so that allocations cannot be optimized away
+#define TOUCH(p, v)        (*(volatile char*)(p) = (char)(v))
+
+/// @brief xorshift pseudo-random number generator (deterministic across allocators)
+static unsigned long rnd(unsigned long *state)
+{
+  unsigned long x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static unsigned long sc_tight(size_t size, unsigned long n)
+{
+  for (unsigned long i = 0; i < n; i += 2) {
+    void *p = xmalloc(size);
+    TOUCH(p, i);
+    xfree(p);
+  }
+  return n / 2 * 2;
+}
+
+static unsigned long sc_lifo(size_t size, unsigned long n)
+{
+  static void *p[BATCH];
+  unsigned long calls = 0;
+
+  while (calls < n) {
+    for (int i = 0; i < BATCH; i++) TOUCH(p[i] = xmalloc(size), i);
+    for (int i = BATCH - 1; i >= 0; i--) xfree(p[i]);
+    calls += 2 * BATCH;
+  }
+  return calls;
+}
+
+static unsigned long sc_fifo(size_t size, unsigned long n)
+{
+  static void *p[BATCH];
+  unsigned long calls = 0;
+
+  while (calls < n) {
+    for (int i = 0; i < BATCH; i++) TOUCH(p[i] = xmalloc(size), i);
+    for (int i = 0; i < BATCH; i++) xfree(p[i]);
+    calls += 2 * BATCH;
+  }
+  return calls;
+}
+
+static unsigned long sc_random(size_t size, unsigned long n)
+{
+  static void *p[BATCH];
+  unsigned long state = 88172645463325252UL, calls = 0;
+
+  for (int i = 0; i < BATCH; i++) TOUCH(p[i] = xmalloc(16 + rnd(&state) % size), i);
+  calls += BATCH;
+
+  while (calls < n) {
+    unsigned long i = rnd(&state) % BATCH;
+    xfree(p[i]);
+    TOUCH(p[i] = xmalloc(16 + rnd(&state) % size), i);
+    calls += 2;
+  }
+
+  for (int i = 0; i < BATCH; i++) xfree(p[i]);
+  return calls + BATCH;
+}
+
+static unsigned long sc_realloc(size_t size, unsigned long n)
+{
+  unsigned long calls = 0;
+
+  while (calls < n) {
+    char *p = NULL;
+    for (size_t s = 64; s <= size; s += 64) {
+      p = xrealloc(p, s);
+      TOUCH(p + s - 1, s);
+      calls++;
+    }
+    xfree(p);
+    calls++;
+  }
+  return calls;
+}
+
+static unsigned long sc_calloc(size_t size, unsigned long n)
+{
+  for (unsigned long i = 0; i < n; i += 2) {
+    void *p = xcalloc(1, size);
+    TOUCH(p, i);
+    xfree(p);
+  }
+  return n / 2 * 2;
+}
+
+/// @brief scenarios and the sizes they are run with
+static const struct {
+  const char *name;                                    ///< name
+  Scenario   run;                                      ///< implementation
+  size_t     size;                                     ///< block size (random: max, realloc: final)
+} scenarios[] = {
+  { "tight",   sc_tight,   16    },
+  { "tight",   sc_tight,   256   },
+  { "tight",   sc_tight,   4096  },
+  { "tight",   sc_tight,   65536 },
+  { "lifo",    sc_lifo,    16    },
+  { "lifo",    sc_lifo,    256   },
+  { "lifo",    sc_lifo,    4096  },
+  { "fifo",    sc_fifo,    16    },
+  { "fifo",    sc_fifo,    256   },
+  { "fifo",    sc_fifo,    4096  },
+  { "random",  sc_random,  4096  },
+  { "realloc", sc_realloc, 65536 },
+  { "calloc",  sc_calloc,  256   },
+  { "calloc",  sc_calloc,  4096  },
+};
+
+#define NSCENARIOS         (sizeof(scenarios)/sizeof(scenarios[0]))    ///< number of scenarios
+
+
+/// @brief current time in nanoseconds
+static unsigned long now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000UL + ts.tv_nsec;
+}
+
+/// @brief two-sided 95% quantile of Student's t distribution with @a df degrees of freedom
+static double t95(int df)
+{
+  static const double t[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+                              2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+                              2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+                              2.042 };
+  if (df < 1) return 0.0;
+  return df < (int)(sizeof(t)/sizeof(t[0])) ? t[df] : 1.96;
+}
+
+/// @brief run scenario @a s with allocator @a a @a reps times and print the results
+/// @param s index into scenarios[]
+/// @param a index into allocators[]
+/// @param reps number of repetitions
+/// @param n number of allocator calls per repetition
+/// @param csv print CSV instead of a table row
+static void measure(int s, int a, int reps, unsigned long n, int csv)
+{
+  const Allocator *al = &allocators[a];
+  double ns[MAX_REPS];
+  unsigned long calls = 0;
+
+  if (al->glibc) {
+    xmalloc = malloc; xcalloc = calloc; xrealloc = realloc; xfree = free;
+  } else {
+    xmalloc = mm_malloc; xcalloc = mm_calloc; xrealloc = mm_realloc; xfree = mm_free;
+  }
+
+  for (int r = 0; r < reps; r++) {
+    if (!al->glibc) {
+      ds_allocate(DSSIZE);
+      mm_setbitmap(al->bitmap);
+      mm_init(al->ap);
+      if (trace && (tr_start(TRACE_RECORDS, 0) < 0)) {
+        fprintf(stderr, "ERROR: cannot allocate trace buffer.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    unsigned long start = now();
+    unsigned long c = scenarios[s].run(scenarios[s].size, n);
+    ns[r] = (double)(now() - start) / c;
+    calls += c;
+
+    if (!al->glibc) {
+      tr_stop();
+      ds_release();
+    }
+  }
+
+  double mean = 0.0, var = 0.0, min = ns[0];
+  for (int r = 0; r < reps; r++) {
+    mean += ns[r] / reps;
+    if (ns[r] < min) min = ns[r];
+  }
+  for (int r = 0; r < reps; r++) var += (ns[r] - mean) * (ns[r] - mean);
+  var = reps > 1 ? var / (reps - 1) : 0.0;
+  double ci = t95(reps - 1) * sqrt(var / reps);
+
+  if (csv) {
+    printf("%s,%lu,%s,%d,%lu,%.2f,%.2f,%.2f\n", scenarios[s].name, scenarios[s].size, al->name,
+           reps, calls, mean, ci, min);
+  } else {
+    printf("  %-8s %6lu  %-12s %10.1f +- %-8.1f %10.1f\n", scenarios[s].name, scenarios[s].size,
+           al->name, mean, ci, min);
+  }
+  fflush(stdout);
+}
+
+/// @brief print usage and terminate
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [-c] [-t] [-r <reps>] [-n <calls>] [-a <allocator>]... [-s <scenario>]...\n"
+                  "  -c             print CSV (scenario,size,allocator,reps,calls,mean_ns,ci95_ns,min_ns)\n"
+                  "  -t             enable event tracing for memmgr allocators\n"
+                  "  -r <reps>      repetitions per measurement (2-%d, default 10)\n"
+                  "  -n <calls>     allocator calls per repetition (default 200000)\n"
+                  "  -a <allocator> run <allocator> only (may be given several times)\n"
+                  "                 default: all of", argv0, MAX_REPS);
+  for (size_t a = 0; a < NALLOCATORS; a++) fprintf(stderr, " %s", allocators[a].name);
+  fprintf(stderr, "\n"
+                  "  -s <scenario>  run <scenario> only (may be given several times)\n"
+                  "                 default: all of tight lifo fifo random realloc calloc\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int asel[NALLOCATORS] = { 0 }, nasel = 0;
+  int ssel[NSCENARIOS] = { 0 }, nssel = 0;
+  int csv = 0, reps = 10, opt;
+  unsigned long n = 200000;
+
+  while ((opt = getopt(argc, argv, "ctr:n:a:s:h")) != -1) {
+    switch (opt) {
+      case 'c': csv = 1; break;
+      case 't': trace = 1; break;
+      case 'r': reps = atoi(optarg); break;
+      case 'n': n = strtoul(optarg, NULL, 0); break;
+      case 'a': {
+        size_t a = 0;
+        while ((a < NALLOCATORS) && (strcmp(optarg, allocators[a].name) != 0)) a++;
+        if (a == NALLOCATORS) syntax(argv[0]);
+        asel[a] = 1;
+        nasel++;
+        break;
+      }
+      case 's': {
+        int found = 0;
+        for (size_t s = 0; s < NSCENARIOS; s++) {
+          if (strcmp(optarg, scenarios[s].name) == 0) ssel[s] = found = 1;
+        }
+        if (!found) syntax(argv[0]);
+        nssel++;
+        break;
+      }
+      default: syntax(argv[0]);
+    }
+  }
+  if ((reps < 2) || (reps > MAX_REPS) || (n == 0) || (optind != argc)) syntax(argv[0]);
+
+  if (csv) {
+    printf("scenario,size,allocator,reps,calls,mean_ns,ci95_ns,min_ns\n");
+  } else {
+    printf("  %-8s %6s  %-12s %22s %10s\n", "scenario", "size", "allocator", "ns/call (95% CI)",
+           "min");
+  }
+
+  for (size_t s = 0; s < NSCENARIOS; s++) {
+    if ((nssel > 0) && !ssel[s]) continue;
+    for (size_t a = 0; a < NALLOCATORS; a++) {
+      if ((nasel == 0) || asel[a]) measure(s, a, reps, n, csv);
+    }
+    if (!csv) printf("\n");
+  }
+
+  return EXIT_SUCCESS;
+}
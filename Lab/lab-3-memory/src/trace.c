@@ -0,0 +1,191 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief binary event tracing for the memory manager and the data segment
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+//
+// Event tracing
+// =============
+// LOG() formats every message synchronously with vfprintf and is only compiled in DEBUG builds.
+// The tracer instead copies a fixed-size binary record (TraceRecord) into a ring buffer and leaves
+// formatting to an offline decoder (mm_tracedump). Every thread claims a chunk of TR_CHUNK slots
+// with one atomic fetch-and-add on the event counter and fills it from a thread-local cursor
+// without further synchronization, so the tracer is lock-free and can be used by foreign threads
+// freeing blocks. The slots of a freshly claimed chunk are marked unused (op tr_None) so that
+// the decoder skips slots that have not been filled yet. Events of one thread are in order;
+// events of different threads are interleaved at chunk granularity. When the ring is full, the
+// oldest records are overwritten.
+//
+// Timestamps are raw time-stamp counter values on x86 and CLOCK_MONOTONIC elsewhere. Even the
+// time-stamp counter costs several times more than the rest of a record (especially in virtual
+// machines), so by default only every 16th event is timestamped and the decoder interpolates the
+// times of the events in between. tr_start() and tr_dump() each take a calibration point so that
+// the decoder can convert ticks to nanoseconds.
+//
+// Tracing is switched on and off at runtime; when it is off, a TRACE() site costs one load of
+// tr_active and a not-taken branch.
+//
+
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TR_DEFAULT         (1 << 20)                   ///< default ring size in records
+#define TR_INTERVAL        16                          ///< default timestamp sampling interval
+#define TR_CHUNK           64                          ///< slots claimed by a thread at a time
+
+/// @name global variables
+/// @{
+int tr_active = 0;                                     ///< tracing active flag
+static TraceRecord *tr_ring  = NULL;                   ///< ring buffer (mmap'ed)
+static size_t tr_size        = 0;                      ///< ring size in records (power of 2)
+static uint64_t tr_interval  = 1;                      ///< timestamp interval (power of 2)
+static uint64_t tr_nevents   = 0;                      ///< number of claimed slots
+static uint64_t tr_gen       = 0;                      ///< generation, incremented by tr_start()
+static __thread uint64_t tr_next  __attribute__((tls_model("initial-exec"))) = 0; ///< next slot
+static __thread uint64_t tr_limit __attribute__((tls_model("initial-exec"))) = 0; ///< end of chunk
+static __thread uint64_t tr_tgen  __attribute__((tls_model("initial-exec"))) = 0; ///< chunk's gen.
+static uint64_t tr_ticks0    = 0;                      ///< calibration: ticks at tr_start()
+static uint64_t tr_ns0       = 0;                      ///< calibration: time at tr_start()
+/// @}
+
+const char *tr_opname[tr_NumOps] = {
+  "malloc", "calloc", "realloc", "free", "rfree", "drain", "purge", "sbrk"
+};
+
+
+/// @brief CLOCK_MONOTONIC in nanoseconds
+static uint64_t tr_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/// @brief current timestamp in ticks
+static inline uint64_t tr_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return tr_ns();
+#endif
+}
+
+int tr_start(size_t nrecords, unsigned int interval)
+{
+  tr_active = 0;
+
+  if (nrecords == 0) nrecords = TR_DEFAULT;
+  size_t size = TR_CHUNK;
+  while (size < nrecords) size <<= 1;
+
+  if (interval == 0) interval = TR_INTERVAL;
+  tr_interval = 1;
+  while (tr_interval < interval) tr_interval <<= 1;
+
+  if (size != tr_size) {
+    if (tr_ring != NULL) munmap(tr_ring, tr_size*sizeof(TraceRecord));
+    tr_size = 0;
+    tr_ring = mmap(NULL, size*sizeof(TraceRecord), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (tr_ring == MAP_FAILED) {
+      tr_ring = NULL;
+      return -1;
+    }
+    tr_size = size;
+  }
+
+  __atomic_store_n(&tr_nevents, 0, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&tr_gen, 1, __ATOMIC_RELAXED);      // invalidates the threads' chunks
+  tr_ns0 = tr_ns();
+  tr_ticks0 = tr_ticks();
+  __atomic_store_n(&tr_active, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+void tr_stop(void)
+{
+  __atomic_store_n(&tr_active, 0, __ATOMIC_RELEASE);
+}
+
+void tr_record(TraceOp op, const void *ptr, uint64_t size, uint32_t search)
+{
+  uint64_t i = tr_next;
+  if ((i == tr_limit) || (tr_tgen != __atomic_load_n(&tr_gen, __ATOMIC_RELAXED))) {
+    // claim a new chunk; TR_CHUNK divides tr_size, so the chunk is contiguous in the ring
+    tr_tgen = __atomic_load_n(&tr_gen, __ATOMIC_RELAXED);
+    i = __atomic_fetch_add(&tr_nevents, TR_CHUNK, __ATOMIC_RELAXED);
+    tr_limit = i + TR_CHUNK;
+    for (uint64_t j = i; j < tr_limit; j++) tr_ring[j & (tr_size - 1)].op = tr_None;
+  }
+  tr_next = i + 1;
+  TraceRecord *r = &tr_ring[i & (tr_size - 1)];
+
+  r->ticks = (i & (tr_interval - 1)) == 0 ? tr_ticks() : 0;
+  r->ptr = (uint64_t)ptr;
+  r->size = size;
+  r->search = search;
+  r->op = op;
+  r->reserved = 0;
+}
+
+int tr_write(int fd, const void *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int tr_dump(int fd)
+{
+  TraceHeader hdr = { .interval = tr_interval, .ticks0 = tr_ticks0, .ns0 = tr_ns0 };
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.ticks1 = tr_ticks();
+  hdr.ns1 = tr_ns();
+  hdr.nevents = __atomic_load_n(&tr_nevents, __ATOMIC_ACQUIRE);
+  hdr.nrecords = hdr.nevents < tr_size ? hdr.nevents : tr_size;
+
+  if (tr_write(fd, &hdr, sizeof(hdr)) < 0) return -1;
+  if (hdr.nrecords == 0) return 0;
+
+  // oldest record first: the ring is written in two parts if it has wrapped
+  size_t first = (hdr.nevents - hdr.nrecords) & (tr_size - 1);
+  size_t n = hdr.nrecords < tr_size - first ? hdr.nrecords : tr_size - first;
+  if (tr_write(fd, &tr_ring[first], n*sizeof(TraceRecord)) < 0) return -1;
+  return tr_write(fd, tr_ring, (hdr.nrecords - n)*sizeof(TraceRecord));
+}
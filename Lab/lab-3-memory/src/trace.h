@@ -0,0 +1,122 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief binary event tracing for the memory manager and the data segment
+/// @author Changmin Choi
+///
+/// @section license_section License
+/// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA,  OR PROFITS; OR BUSINESS INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief traced operations
+typedef enum {
+  tr_Malloc,                      ///< mm_malloc(): ptr = result, size = requested size
+  tr_Calloc,                      ///< mm_calloc(): ptr = result, size = requested size
+  tr_Realloc,                     ///< mm_realloc(): ptr = result, size = requested size
+  tr_Free,                        ///< mm_free()/mm_free_sized(): ptr, size = block size
+  tr_RemoteFree,                  ///< free by a foreign thread (deferred): ptr, size = block size
+  tr_Drain,                       ///< owner drained remote frees: size = number of blocks
+  tr_Purge,                       ///< mm_purge()/auto-purge: ptr = block, size = bytes released
+  tr_Sbrk,                        ///< ds_sbrk(): ptr = old brk, size = increment (signed)
+  tr_NumOps,                      ///< number of operations
+  tr_None = 0xffff                ///< unused slot (claimed, but not filled yet)
+} TraceOp;
+
+/// @brief magic number of a trace file
+#define TRACE_MAGIC "CSAPTRC1"
+
+/// @brief one trace record (32 bytes)
+typedef struct {
+  uint64_t ticks;                 ///< timestamp in clock ticks (see TraceHeader), 0 if not sampled
+  uint64_t ptr;                   ///< pointer argument or result
+  uint64_t size;                  ///< size argument
+  uint32_t search;                ///< number of blocks visited by the free block search
+  uint16_t op;                    ///< TraceOp
+  uint16_t reserved;              ///< unused, 0
+} TraceRecord;
+
+/// @brief header of a trace file written by tr_dump(). The header is followed by @a nrecords
+///        records, oldest first. Records with op == tr_None are unused slots. Only every
+///        @a interval-th event (by event number) carries a timestamp; the times of the others are
+///        interpolated. Ticks are converted to nanoseconds by linear interpolation between the two
+///        calibration points (ticks0, ns0) taken by tr_start() and (ticks1, ns1) taken by
+///        tr_dump().
+typedef struct {
+  char     magic[8];              ///< TRACE_MAGIC
+  uint64_t nrecords;              ///< number of records following the header
+  uint64_t nevents;               ///< number of slots claimed (> nrecords if the ring wrapped)
+  uint64_t interval;              ///< timestamp sampling interval in events
+  uint64_t ticks0;                ///< calibration: ticks at tr_start()
+  uint64_t ns0;                   ///< calibration: CLOCK_MONOTONIC at tr_start() in nanoseconds
+  uint64_t ticks1;                ///< calibration: ticks at tr_dump()
+  uint64_t ns1;                   ///< calibration: CLOCK_MONOTONIC at tr_dump() in nanoseconds
+} TraceHeader;
+
+/// @brief tracing active flag. Do not modify directly; use tr_start()/tr_stop()
+extern int tr_active;
+
+/// @brief record an event if tracing is active. Costs a load and a not-taken branch otherwise.
+#define TRACE(op, ptr, size, search) \
+  do { if (__builtin_expect(tr_active, 0)) tr_record(op, ptr, size, search); } while (0)
+
+/// @brief start tracing into a ring buffer of @a nrecords records (rounded up to a power of two;
+///        0 selects the default of 1M records). Older records are overwritten once the ring is
+///        full. Restarting discards all records.
+/// @param nrecords ring buffer size in records
+/// @param interval take a timestamp every @a interval events (rounded up to a power of two;
+///        0 selects the default of 16, 1 timestamps every event). Reading the clock dominates
+///        the cost of a record.
+/// @retval 0 on success
+/// @retval -1 if the ring buffer cannot be allocated
+int tr_start(size_t nrecords, unsigned int interval);
+
+/// @brief stop tracing. The recorded events are kept for tr_dump().
+void tr_stop(void);
+
+/// @brief write the recorded events (TraceHeader followed by the records, oldest first) to @a fd.
+///        Must not race with threads still recording events.
+/// @retval 0 on success
+/// @retval -1 on write error
+int tr_dump(int fd);
+
+/// @brief write @a len bytes from @a buf to @a fd, retrying partial writes. Also used to write
+///        heap snapshots (mm_snapshot()).
+/// @retval 0 on success
+/// @retval -1 on error
+int tr_write(int fd, const void *buf, size_t len);
+
+/// @brief record an event. Do not call directly; use TRACE() instead. Safe to call from any
+///        thread.
+void tr_record(TraceOp op, const void *ptr, uint64_t size, uint32_t search);
+
+/// @brief names of the traced operations
+extern const char *tr_opname[tr_NumOps];
+
+#endif // __TRACE_H__